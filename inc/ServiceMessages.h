@@ -7,5 +7,17 @@
 #define SERVICE_CMD_STATUS						"STATUS"
 #define SERVICE_CMD_SHOW						"SHOW"
 #define SERVICE_CMD_LIST						"LIST"
+#define SERVICE_CMD_SUBSCRIBE					"SUBSCRIBE"
+#define SERVICE_CMD_BATCH						"BATCH"
+
+/* lifecycle events pushed to subscribers */
+#define SERVICE_EVENT_STARTED					"started"
+#define SERVICE_EVENT_FAILED					"failed"
+#define SERVICE_EVENT_EXITED					"exited"
+#define SERVICE_EVENT_KILLED					"killed"
+#define SERVICE_EVENT_RESPAWN					"respawn"
+#define SERVICE_EVENT_STOPPING					"stopping"
+#define SERVICE_EVENT_STOPPED					"stopped"
+#define SERVICE_EVENT_STARTING					"starting"
 
 #endif /* SERVICEMESSAGES_H_ */
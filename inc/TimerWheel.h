@@ -0,0 +1,193 @@
+#ifndef TIMERWHEEL_H_
+#define TIMERWHEEL_H_
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * @brief Hierarchical timing wheel on CLOCK_MONOTONIC driven by a timerfd
+ *
+ * Timers are kept in #LEVELS levels of #SLOTS slots, level L covers delays
+ * up to SLOTS^(L+1) ticks. Adding and cancelling a timer is O(1), timers are
+ * moved to lower levels (cascaded) as time advances and fired from level 0.
+ *
+ * The timerfd is armed with the next tick that needs processing, so nothing
+ * is scanned and the owner is not woken up while no timer is due.
+ *
+ * Usage;
+ * @code
+ *		TimerWheel timers;
+ *		timers.open();
+ *		// add timers.getFd() to the poll set
+ *		TimerWheel::timer_id id = timers.add(1000, MY_TIMER, "name");
+ *		...
+ *		// when timers.getFd() is readable
+ *		std::vector<TimerWheel::Expired> expired;
+ *		timers.expire(expired);
+ * @endcode
+ */
+class TimerWheel
+{
+public:
+	/** @brief Timer handle, 0 is never a valid id */
+	typedef uint64_t timer_id;
+
+	/** @brief Expired timer */
+	struct Expired
+	{
+		timer_id id;
+		int type;
+		std::string key;
+	};
+
+	/**
+	 * @brief Create a timer wheel
+	 * @param resolution	tick length in milliseconds
+	 */
+	TimerWheel(const uint64_t resolution = 1);
+
+	/**
+	 * @brief Virtual destructor
+	 */
+	virtual ~TimerWheel();
+
+	/**
+	 * @brief Create timerfd
+	 * @return			true if successfully opened, otherwise false
+	 */
+	bool open();
+
+	/**
+	 * @brief Close timerfd
+	 */
+	void close();
+
+	/**
+	 * @brief Return timerfd, readable when a timer is due
+	 */
+	inline int getFd() const;
+
+	/**
+	 * @brief Add a timer
+	 * @param delay		delay in milliseconds
+	 * @param type		user defined timer type
+	 * @param key		user defined key (e.g. service name)
+	 * @return			timer id
+	 */
+	timer_id add(const uint64_t delay, const int type, const std::string & key);
+
+	/**
+	 * @brief Cancel a timer
+	 * @param id		timer id
+	 * @return			true if timer was pending, otherwise false
+	 */
+	bool cancel(const timer_id id);
+
+	/**
+	 * @brief Check whether timer is pending
+	 * @param id		timer id
+	 */
+	bool pending(const timer_id id) const;
+
+	/**
+	 * @brief Pending timer count
+	 */
+	inline size_t size() const;
+
+	/**
+	 * @brief Consume timerfd expiration, collect due timers and re-arm timerfd
+	 * @param expired	due timers (appended)
+	 */
+	void expire(std::vector<Expired> & expired);
+
+	/**
+	 * @brief Advance wheel up to given tick and collect due timers
+	 * @param tick		current tick
+	 * @param expired	due timers (appended)
+	 */
+	void advance(const uint64_t tick, std::vector<Expired> & expired);
+
+	/**
+	 * @brief Next tick to be processed
+	 * @param tick		next tick if any timer is pending
+	 * @return			false if no timer is pending
+	 */
+	bool next_tick(uint64_t & tick) const;
+
+	/**
+	 * @brief Current tick of the monotonic clock
+	 */
+	uint64_t current_tick() const;
+
+	/** @brief Level count */
+	const static int LEVELS = 5;
+	/** @brief Slot count of a level as power of 2 */
+	const static int SLOT_BITS = 6;
+	/** @brief Slot count of a level */
+	const static int SLOTS = 1 << SLOT_BITS;
+
+protected:
+
+	struct Node
+	{
+		uint64_t expires;
+		int type;
+		std::string key;
+		uint32_t generation;
+		/** slot index (level * SLOTS + slot), -1 if free */
+		int slot;
+		int prev;
+		int next;
+	};
+
+	/**
+	 * @brief Put node into its slot relative to current tick
+	 * @param index		node index
+	 * @param current	a due timer goes to the current slot, which is fired next (cascade)
+	 */
+	void insert(const int index, const bool current = false);
+
+	/** @brief Remove node from its slot */
+	void unlink(const int index);
+
+	/** @brief Release node */
+	void release(const int index);
+
+	/** @brief Re-insert timers of the current slot of given level */
+	void cascade(const int level);
+
+	/** @brief Arm timerfd with next tick, disarm if no timer is pending */
+	void arm();
+
+	uint64_t resolution;
+
+	/** @brief last processed tick */
+	uint64_t tick;
+	/** @brief tick timerfd is armed for, 0 if disarmed */
+	uint64_t armed_tick;
+
+	int timer_fd;
+
+	std::vector<Node> nodes;
+	std::vector<int> free_nodes;
+	size_t pending_count;
+
+	/** @brief first node of each slot, -1 if empty */
+	int heads[LEVELS * SLOTS];
+	/** @brief non-empty slot bitmap of each level */
+	uint64_t occupied[LEVELS];
+};
+
+inline int TimerWheel::getFd() const
+{
+	return timer_fd;
+}
+
+inline size_t TimerWheel::size() const
+{
+	return pending_count;
+}
+
+#endif /* TIMERWHEEL_H_ */
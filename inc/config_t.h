@@ -2,6 +2,7 @@
 #define CONFIG_T_H_
 
 #include <string>
+#include <vector>
 
 #include <serializer/Serializable.h>
 
@@ -30,8 +31,6 @@ public:
 	/** @brief service command */
 	std::string exec;
 	bool is_script;
-	/** @brief temporary script filepath if script defined */
-	std::string script_filepath;
 
 	/** @brief command to run on stop */
 	std::string onstop_exec;
@@ -43,6 +42,25 @@ public:
 	bool respawn;
 	int respawn_limit;
 	int respawn_interval;
+
+	/** @brief time to wait for exit after stop signal before SIGKILL, in milliseconds */
+	int stop_timeout;
+	/** @brief signal sent to stop service */
+	int stop_signal;
+
+	/** @brief services started before this one, start fails if any of them fails */
+	std::vector<std::string> required_services;
+	/** @brief services started before this one if they are started together */
+	std::vector<std::string> after_services;
+
+	/** @brief default stop timeout in milliseconds */
+	static const int default_stop_timeout = 3000;
+
+	/**
+	 * @brief Parse signal name or number (e.g. "SIGTERM", "TERM", "15")
+	 * @return			signal number or -1 if invalid
+	 */
+	static int parse_signal(const std::string & s);
 };
 
 #endif /* CONFIG_T_H_ */
@@ -16,9 +16,9 @@
 
 #define DIRPATH_SERVICES		"./services"
 #define DIRPATH_RUNTIME			"/run"
-#define DIRPATH_SERVICE_SCRIPTS	"/run/shm/service"
 #define DIRPATH_SERVICE_PIDS	DIRPATH_RUNTIME "/service"
 #define FILEPATH_SERVICES_LIST	DIRPATH_SERVICE_PIDS "/services.list"
+#define FILEPATH_SERVICES_STATUS	DIRPATH_SERVICE_PIDS "/services.status"
 
 
 #define FILE_EXTENSION_CONFIG	".conf"
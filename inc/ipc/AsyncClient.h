@@ -0,0 +1,119 @@
+#ifndef ASYNCCLIENT_H_
+#define ASYNCCLIENT_H_
+
+#include <deque>
+#include <map>
+#include <string>
+
+#include "ipc/DomainClient.h"
+
+/**
+ * @brief Pipelined client, many requests in flight on one connection
+ *
+ * Each request is tagged with a request id (see DomainServer), replies are
+ * matched by id in any order. A request completes with a callback or with
+ * wait() on its id, a future-like blocking get; replies of other requests
+ * received meanwhile are dispatched to their callbacks or kept for their
+ * wait(). Replies of unknown (cancelled) requests are dropped.
+ *
+ * Streamed replies (e.g. chunks of a LIST response) keep the request in
+ * flight while the callback returns true or wait() is called with last =
+ * false.
+ */
+class AsyncClient: public DomainClient
+{
+public:
+	/**
+	 * @brief Reply handler
+	 * @param request_id	request id returned by submit()
+	 * @param reply			reply bundle
+	 * @param context		context given to submit()
+	 * @return				true if more replies are expected for the request
+	 */
+	typedef bool (*Callback)(uint32_t request_id, Bundle & reply,
+			void * context);
+
+	/**
+	 * @brief Create a client of given server (use is_open() for checking)
+	 * @param server_path	server socket address
+	 */
+	AsyncClient(const std::string & server_path);
+
+	/**
+	 * @brief Virtual destructor
+	 */
+	virtual ~AsyncClient();
+
+	/**
+	 * @brief Send a request without waiting for its reply
+	 * @param request	request bundle
+	 * @param callback	reply handler, NULL to collect the reply with wait()
+	 * @param context	passed to callback
+	 * @return			request id, 0 if request could not be sent
+	 */
+	uint32_t submit(const Bundle & request, Callback callback = NULL,
+			void * context = NULL);
+
+	/**
+	 * @brief Wait for the next reply of a request submitted without callback
+	 * @param request_id	request id
+	 * @param reply			reply bundle
+	 * @param milliseconds	timeout in milliseconds
+	 * @param last			false if more replies are expected (request stays in flight)
+	 * @return				false on timeout, broken connection or unknown request
+	 */
+	bool wait(const uint32_t request_id, Bundle & reply,
+			const long long milliseconds = LLONG_MAX, const bool last = true);
+
+	/**
+	 * @brief Dispatch received replies to callbacks
+	 * @param milliseconds	time to wait for the first reply
+	 * @return				dispatched reply count
+	 */
+	int dispatch(const long long milliseconds = 0);
+
+	/**
+	 * @brief Dispatch replies until no callback request is in flight
+	 * @param milliseconds	timeout in milliseconds
+	 * @return				false on timeout or broken connection
+	 */
+	bool drain(const long long milliseconds = LLONG_MAX);
+
+	/**
+	 * @brief Forget a request, its late replies are dropped
+	 */
+	void cancel(const uint32_t request_id);
+
+	/**
+	 * @brief Requests waiting for a reply
+	 */
+	inline size_t in_flight() const;
+
+protected:
+	struct Request
+	{
+		Callback callback;
+		void * context;
+		/** replies not taken by wait() yet */
+		std::deque<std::string> replies;
+	};
+
+	/**
+	 * @brief Receive one message and route it to its request
+	 * @return			false on timeout or broken connection
+	 */
+	bool route(const long long milliseconds);
+
+	/** @brief Requests with callbacks in flight */
+	size_t callbacks() const;
+
+	std::string server_path;
+	std::map<uint32_t, Request> requests;
+};
+
+inline size_t AsyncClient::in_flight() const
+{
+	return requests.size();
+}
+
+#endif /* ASYNCCLIENT_H_ */
@@ -3,11 +3,18 @@
 
 #include <string>
 #include <climits>
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <stdint.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 
 #include "serializer/Bundle.h"
+#include "serializer/BundleView.h"
 
 /**
  * @author Sinan Emre Kutlu
@@ -15,6 +22,37 @@
  * @date 2013/08/29
  *
  * @brief This class is used for the purpose of IPC
+ *
+ * Messages are carried over SOCK_SEQPACKET connections in the abstract
+ * namespace. A message is split into packets of at most #PACKET_SIZE bytes,
+ * the first packet starts with a #HEADER_SIZE bytes header: message length
+ * and request id (4 bytes each, big endian), so message size is not limited
+ * by the packet size. Packets are gathered from the message regions with
+ * sendmsg(), a message is copied only if the socket can not take it at once.
+ *
+ * Request ids correlate replies with requests. A message with request id N
+ * from peer P is received from the address "P#N" (just "P" if N is 0) and
+ * a message sent to "P#N" carries N, so replying to the source address of
+ * a request tags the reply with the request id. See reply_address().
+ *
+ * The server accepts connections and identifies each peer by the address
+ * the peer socket is bound to (see DomainClient), replies are sent to that
+ * address like datagrams. Server sockets are non-blocking, messages that
+ * can not be sent immediately are queued and sent when the connection gets
+ * writable; getFd() is an epoll fd that becomes readable when a connection
+ * is readable or writable, recvfrom() processes it.
+ *
+ * The server reads up to #BATCH_SIZE packets of a connection per recvmmsg()
+ * call into a ring of packet buffers. Replies are sent straight from the
+ * bundle regions; only packets that do not fit the socket are copied into
+ * the connection queue, which is sent with sendmmsg().
+ *
+ * The server closes connections sending a message larger than
+ * #MAX_MESSAGE_SIZE or queueing more than #MAX_QUEUED_MESSAGES messages
+ * not read yet, so a peer can not hold unbounded memory.
+ *
+ * Bundles are sent in format v2. A peer whose bundles arrive in format v1
+ * (old clients) gets bundles in format v1 as well, see Bundle.
  */
 class DomainServer
 {
@@ -44,7 +82,7 @@ public:
 	inline bool is_open() const;
 
 	/**
-	 * @brief Return socket file descriptor
+	 * @brief Return file descriptor to poll for input (and queued output)
 	 */
 	inline int getFd();
 
@@ -95,6 +133,16 @@ public:
 	int sendto(const std::string & dst_path, const unsigned char * buf,
 			const int size = -1);
 
+	/**
+	 * @brief Send data gathered from buffer regions to the destination process
+	 * @param dst_path	destination socket address or empty string for previously defined address path
+	 * @param iov		message regions
+	 * @param iovcnt	region count, at most #MAX_REGIONS
+	 * @return			sent byte count, or -1
+	 */
+	int sendmsg(const std::string & dst_path, const struct iovec * iov,
+			const int iovcnt);
+
 	/**
 	 * @brief Send data to the destination process
 	 * @param dst_path	destination socket address or empty string for previously defined address path
@@ -141,6 +189,24 @@ public:
 	 */
 	bool recvfrom(std::string & src_path, Bundle & bundle);
 
+	/**
+	 * @brief Receive bundle from the source process with a timeout
+	 * @param src_path		source socket address
+	 * @param bundle		bundle to receive
+	 * @param milliseconds	timeout in milliseconds (client), server never waits
+	 * @return				true if successfully received, otherwise false
+	 */
+	bool recvfrom(std::string & src_path, Bundle & bundle,
+			const long long milliseconds);
+
+	/**
+	 * @brief Receive bundle from the source process without copying it
+	 * @param src_path	source socket address
+	 * @param view		view of the received bundle, valid until next receive
+	 * @return			true if successfully received, otherwise false
+	 */
+	bool recvfrom(std::string & src_path, BundleView & view);
+
 	/**
 	 * @brief Receive data from the source process
 	 * @param src_path	source socket address
@@ -179,7 +245,30 @@ public:
 			Bundle & toReceive, const long long milliseconds = LLONG_MAX);
 
 	/**
-	 * @brief Clear socket receive buffer
+	 * @brief Byte count of queued messages not sent to the destination yet
+	 * @param dst_path	destination socket address
+	 */
+	size_t pending(const std::string & dst_path) const;
+
+	/**
+	 * @brief Address of a peer tagged with a request id ("peer#id")
+	 * @param path		peer address
+	 * @param request_id	request id, 0 for untagged address
+	 */
+	static std::string reply_address(const std::string & path,
+			const uint32_t request_id);
+
+	/**
+	 * @brief Split address into peer address and request id
+	 * @param address	address, optionally tagged with a request id
+	 * @param path		peer address
+	 * @return			request id, 0 if address is not tagged
+	 */
+	static uint32_t split_address(const std::string & address,
+			std::string & path);
+
+	/**
+	 * @brief Drop received messages not read yet
 	 */
 	void clear();
 
@@ -188,12 +277,150 @@ public:
 	 */
 	void close();
 
+	/** @brief max packet size in bytes */
+	static const int PACKET_SIZE = 32768;
+	/** @brief message header (length and request id) size in bytes */
+	static const int HEADER_SIZE = 8;
+	/** @brief max region count of a message, see sendmsg() */
+	static const int MAX_REGIONS = 16;
+	/** @brief max packets per recvmmsg() or sendmmsg() call */
+	static const int BATCH_SIZE = 16;
+	/** @brief max message size accepted by the server in bytes */
+	static const size_t MAX_MESSAGE_SIZE = 4 * 1024 * 1024;
+	/** @brief max received messages of a connection not read yet (server) */
+	static const size_t MAX_QUEUED_MESSAGES = 1024;
+
 protected:
+	/** @brief connected peer */
+	struct Connection
+	{
+		int fd;
+		std::string peer;
+
+		/** received part of the current message */
+		std::string in;
+		/** length of the current message, 0 if waiting for a new message */
+		size_t in_length;
+		/** request id of the current message */
+		uint32_t in_id;
+		/** received messages not read yet */
+		size_t queued;
+
+		/** packets not sent yet */
+		std::deque<std::string> out;
+		size_t out_bytes;
+		/** EPOLLOUT is enabled */
+		bool out_watched;
+
+		/** peer sends bundles in format v1, bundles are sent to it in v1 */
+		bool legacy;
+	};
+
+	/**
+	 * @brief Create socket and bind it to given abstract path
+	 * @param path		address path
+	 * @param flags		additional socket type flags (SOCK_NONBLOCK)
+	 */
+	bool bind(const std::string & path, const int flags);
+
+	/** @brief Create the listening socket */
+	bool listen(const std::string & path);
+
+	/** @brief Connect client socket to the server */
+	bool connect(const std::string & dst_path);
+
+	/**
+	 * @brief Return next received message
+	 * @param src_path		source socket address
+	 * @param data			message
+	 * @param milliseconds	time to wait for a message (client)
+	 * @return				false if no message is available
+	 */
+	bool receive(std::string & src_path, std::string & data,
+			const long long milliseconds);
+
+	/** @brief Process ready connections without waiting (server) */
+	void poll_events();
+
+	/** @brief Accept pending connections */
+	void accept_connections();
+
+	/** @brief Handle readiness of a connection */
+	void process(Connection & c, uint32_t events);
+
+	/**
+	 * @brief Read available packets of a connection, complete messages are queued
+	 * @return			false if connection is closed or broken
+	 */
+	bool read_packets(Connection & c);
+
+	/**
+	 * @brief Append a received packet to the current message of a connection
+	 * @return			false if packet is invalid or connection exceeds server limits
+	 */
+	bool read_packet(Connection & c, const unsigned char * data, size_t size);
+
+	/**
+	 * @brief Queue the completed message of a connection
+	 * @return			false if connection has too many messages queued (server)
+	 */
+	bool queue_received(Connection & c);
+
+	/**
+	 * @brief Send message packets directly while the socket takes them, queue the rest
+	 * @return			false if connection is broken
+	 */
+	bool send_message(Connection & c, const uint32_t request_id,
+			const struct iovec * iov, const int iovcnt, const size_t size);
+
+	/**
+	 * @brief Split message into packets and queue them
+	 * @param offset	first message byte to queue, packet boundary
+	 */
+	void queue_message(Connection & c, const uint32_t request_id,
+			const struct iovec * iov, const int iovcnt, const size_t size,
+			size_t offset);
+
+	/**
+	 * @brief Regions of a byte range of a message
+	 * @param parts		destination, room for iovcnt regions
+	 * @return			region count
+	 */
+	static int gather(const struct iovec * iov, const int iovcnt,
+			size_t offset, size_t length, struct iovec * parts);
+
+	/** @brief Fill message header (length and request id) */
+	static void make_header(unsigned char * header, const size_t size,
+			const uint32_t request_id);
+
+	/**
+	 * @brief Send queued packets until socket would block
+	 * @return			false if connection is broken
+	 */
+	bool flush(Connection & c);
+
+	/** @brief Enable/disable EPOLLOUT for queued packets if not done yet */
+	void update_events(Connection & c);
+
+	/** @brief Close connection */
+	void close_connection(int fd);
+
+	/** @brief Connection of a peer address (request id is ignored), NULL if none */
+	Connection * find_connection(const std::string & address);
+
+	/** @brief Remember bundle format of the peer of a received message */
+	void set_format(const std::string & src_path, const std::string & data);
+
+	/** @brief Wait until fd is readable */
+	bool wait_readable(int fd, const long long milliseconds);
+
 	std::string socket_path;
+	/** listening socket (server) or connected socket (client) */
 	int socket_fd;
-	struct sockaddr_un server_address;
-	struct sockaddr_un client_address;
-	socklen_t address_length;
+	/** epoll set of listening socket and connections (server) */
+	int epoll_fd;
+	/** server socket listens for connections */
+	bool listening;
 
 	/** socket open flag */
 	bool b_open;
@@ -201,7 +428,23 @@ protected:
 	/** client socket path */
 	std::string client_path;
 
-	unsigned char tmpBuf[16384];
+	/** connections by fd */
+	std::map<int, Connection> connections;
+	/** connection fds by peer address */
+	std::map<std::string, int> peers;
+	/** received messages (source address with request id, data) not read yet */
+	std::deque<std::pair<std::string, std::string> > messages;
+	/** counter for peers without address */
+	unsigned int anonymous_peers;
+	/** last request id of query() */
+	uint32_t last_request_id;
+
+	/** last message received into a BundleView */
+	std::string received;
+	/** packet buffers of recvmmsg(), #BATCH_SIZE packets (server) */
+	std::vector<unsigned char> ring;
+
+	unsigned char tmpBuf[PACKET_SIZE];
 };
 
 bool DomainServer::is_open() const
@@ -211,7 +454,7 @@ bool DomainServer::is_open() const
 
 inline int DomainServer::getFd()
 {
-	return socket_fd;
+	return listening ? epoll_fd : socket_fd;
 }
 
 std::string DomainServer::path() const
@@ -3,6 +3,7 @@
 
 #include "DomainServer.h"
 #include "DomainClient.h"
+#include "AsyncClient.h"
 
 #define IPC_PATH_SERVICE				"SERVICE"
 
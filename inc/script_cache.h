@@ -0,0 +1,81 @@
+#ifndef SCRIPT_CACHE_H_
+#define SCRIPT_CACHE_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+
+/**
+ * @brief Script bodies of script services compiled into sealed memfds
+ *
+ * Each distinct script content is written once into a memfd, sealed against
+ * modification and re-opened read-only (a file open for writing can not be
+ * executed). Starting or respawning a script service does not touch the
+ * filesystem, the cached fd is passed to the service process and executed.
+ *
+ * Entries are keyed by FNV-1a hash of the content, content is compared on
+ * lookup so a hash collision only replaces the entry.
+ */
+class script_cache
+{
+public:
+	/**
+	 * @brief Create an empty cache
+	 * @param limit		max cached script count
+	 */
+	script_cache(const size_t limit = default_limit);
+
+	/**
+	 * @brief Virtual destructor, closes cached fds
+	 */
+	virtual ~script_cache();
+
+	/**
+	 * @brief Return sealed read-only memfd of the script, create if not cached
+	 * @param name		name of the memfd (shown in /proc/<pid>/fd)
+	 * @param content	script content
+	 * @return			fd owned by the cache (close-on-exec), -1 on error
+	 */
+	int get(const std::string & name, const std::string & content);
+
+	/**
+	 * @brief Close all cached fds
+	 */
+	void clear();
+
+	/**
+	 * @brief Cached script count
+	 */
+	inline size_t size() const;
+
+	/** @brief default max cached script count */
+	static const size_t default_limit = 128;
+
+protected:
+	struct entry
+	{
+		int fd;
+		std::string content;
+	};
+
+	/** @brief 64-bit FNV-1a hash */
+	static uint64_t hash(const std::string & content);
+
+	/**
+	 * @brief Write content into a new memfd and seal it
+	 * @return			read-only fd, -1 on error
+	 */
+	static int create(const std::string & name, const std::string & content);
+
+	size_t limit;
+
+	std::map<uint64_t, entry> entries;
+};
+
+inline size_t script_cache::size() const
+{
+	return entries.size();
+}
+
+#endif /* SCRIPT_CACHE_H_ */
@@ -1,6 +1,7 @@
 #ifndef AUTORESIZINGBUF_H_
 #define AUTORESIZINGBUF_H_
 
+#include <algorithm>
 #include <stdexcept>
 
 /**
@@ -10,6 +11,9 @@
  *
  * @brief This class can be used as infinite array
  *
+ * Capacity grows geometrically (at least doubles), so appending element by
+ * element costs amortized constant time. Buffers of up to #local_capacity
+ * elements are kept inside the object without a heap allocation.
  */
 template<class T>
 class AutoResizingBuf
@@ -22,28 +26,49 @@ public:
 	 * @param capacity		initial capacity
 	 */
 	AutoResizingBuf(const int capacity = step) :
-			capacity(capacity), buf(new T[capacity])
+			capacity(local_capacity), buf(local)
 	{
+		reserve(capacity);
 	}
 
 	/**
 	 * @brief Copy constructor
 	 */
 	AutoResizingBuf(const AutoResizingBuf<T> &autoBuf) :
-			capacity(autoBuf.capacity)
+			capacity(local_capacity), buf(local)
 	{
-		buf = new T[capacity];
+		reserve(autoBuf.capacity);
 
-		for (int i = 0; i < capacity; ++i)
-			buf[i] = autoBuf.buf[i];
+		std::copy(autoBuf.buf, autoBuf.buf + autoBuf.capacity, buf);
 	}
 
+#if __cplusplus >= 201103L
+	/**
+	 * @brief Move constructor, takes the heap buffer of autoBuf
+	 */
+	AutoResizingBuf(AutoResizingBuf<T> &&autoBuf) :
+			capacity(local_capacity), buf(local)
+	{
+		swap(autoBuf);
+	}
+
+	/**
+	 * @brief Move assignment operator
+	 */
+	AutoResizingBuf & operator =(AutoResizingBuf<T> &&autoBuf)
+	{
+		swap(autoBuf);
+		return *this;
+	}
+#endif
+
 	/**
 	 * @brief Virtual destructor
 	 */
 	virtual ~AutoResizingBuf()
 	{
-		delete[] buf;
+		if (buf != local)
+			delete[] buf;
 	}
 
 	/**
@@ -53,14 +78,12 @@ public:
 	 */
 	const AutoResizingBuf & operator =(const AutoResizingBuf<T> &autoBuf)
 	{
-		capacity = autoBuf.capacity;
+		if (this == &autoBuf)
+			return *this;
 
-		delete[] buf;
+		resize(autoBuf.capacity);
 
-		buf = new T[capacity];
-
-		for (int i = 0; i < capacity; ++i)
-			buf[i] = autoBuf.buf[i];
+		std::copy(autoBuf.buf, autoBuf.buf + autoBuf.capacity, buf);
 
 		return *this;
 	}
@@ -74,11 +97,7 @@ public:
 	{
 		// if index larger than the capacity, then resize buf
 		if (index >= capacity)
-		{
-			int new_capacity = (index / step + 1) * step;
-
-			resize(new_capacity);
-		}
+			reserve(index + 1);
 
 		return buf[index];
 	}
@@ -113,7 +132,23 @@ public:
 	}
 
 	/**
-	 * @brief Resize buffer
+	 * @brief Make room for at least \a capacity elements, grows geometrically
+	 * @param capacity			required capacity
+	 */
+	void reserve(const int capacity)
+	{
+		if (capacity <= this->capacity)
+			return;
+
+		int new_capacity = this->capacity * 2;
+		if (new_capacity < capacity)
+			new_capacity = (capacity / step + 1) * step;
+
+		resize(new_capacity);
+	}
+
+	/**
+	 * @brief Resize buffer, content that fits is kept
 	 * @param capacity			new capacity
 	 */
 	void resize(const int capacity = step)
@@ -122,25 +157,61 @@ public:
 			throw std::invalid_argument(
 					"AutoBuf: new capacity value cannot be less than zero.");
 
-		if (this->capacity == capacity)
+		// small buffers live in the object
+		int new_capacity = (capacity < local_capacity) ? local_capacity
+				: capacity;
+
+		if (this->capacity == new_capacity)
 			return;
 
-		// allocate new array
-		T * tmp = new T[capacity];
+		T * tmp = (new_capacity == local_capacity) ? local : new T[new_capacity];
 
 		// copy content
-		int copy_count = MIN(this->capacity, capacity);
-		for (int i = 0; i < copy_count; ++i)
-			tmp[i] = buf[i];
+		int copy_count = MIN(this->capacity, new_capacity);
+		if (tmp != buf)
+			std::copy(buf, buf + copy_count, tmp);
 
-		// save new capacity
-		this->capacity = capacity;
+		if (buf != local)
+			delete[] buf;
 
-		// redirect to new array
-		delete[] buf;
+		// save new capacity
+		this->capacity = new_capacity;
 		buf = tmp;
 	}
 
+	/**
+	 * @brief Copy elements to the beginning of the buffer
+	 * @param data				source elements
+	 * @param count				element count
+	 */
+	void assign(const T * data, const int count)
+	{
+		reserve(count);
+
+		std::copy(data, data + count, buf);
+	}
+
+	/**
+	 * @brief Exchange content with another buffer without copying heap buffers
+	 */
+	void swap(AutoResizingBuf<T> &autoBuf)
+	{
+		if (this == &autoBuf)
+			return;
+
+		T tmp_local[local_capacity];
+
+		std::copy(local, local + local_capacity, tmp_local);
+		std::copy(autoBuf.local, autoBuf.local + local_capacity, local);
+		std::copy(tmp_local, tmp_local + local_capacity, autoBuf.local);
+
+		T * tmp_buf = (buf == local) ? autoBuf.local : buf;
+		buf = (autoBuf.buf == autoBuf.local) ? local : autoBuf.buf;
+		autoBuf.buf = tmp_buf;
+
+		std::swap(capacity, autoBuf.capacity);
+	}
+
 	/**
 	 * @brief Buffer size
 	 * @return					buffer size
@@ -155,10 +226,16 @@ protected:
 	/** @brief Buffer step size used at reallocation level */
 	const static int step = 64;
 
+	/** @brief Capacity of the buffer inside the object */
+	const static int local_capacity = 64;
+
 	/** @brief Buffer size */
 	int capacity;
 
 	T * buf;
+
+	/** @brief Buffer of small contents */
+	T local[local_capacity];
 };
 
 #endif /* AUTORESIZINGBUF_H_ */
@@ -6,6 +6,10 @@
 #include <string>
 #include <vector>
 
+#include <stdint.h>
+
+#include <sys/uio.h>
+
 #include "AutoResizingBuf.h"
 
 class Serializable;
@@ -18,16 +22,27 @@ class Serializable;
  * @brief This class is used to serialize primitive types, strings, objects etc.
  * Main purpose is to provide a communication channel between processes via DomainSocket class.
  *
- * Buffer:  [T] [C] [L1][D1] [L2][D2] [L3][D3]...
+ * Buffer:  [V] [T] [C] [D1][D2][D3]... [T] [C] [L1][D1] [L2][D2]...
+ *
+ * [V] : Format version #FORMAT_V2, only in front of exported data	(1 byte)
+ * [T] : Type												(1 byte)
+ * [C] : Count, LEB128 varint								(1-5 bytes)
+ * [L] : Length of following data, LEB128 varint			(1-5 bytes)
+ * [D] : Data												(n bytes)
  *
- * [T] : Type							(1 byte)
- * [C] : Count							(2 bytes)
- * [L] : Length of following data		(2 bytes)
- * [D] : Data							(n bytes)
+ * Fixed width types (int, char, double, int64, uint64) are stored back to
+ * back without lengths, so arrays are contiguous blocks copied at once.
+ * Bools are packed into bits (least significant bit first), strings and
+ * blobs have lengths.
  *
+ * Format v1 of old peers has no version byte, 2 bytes counts and 2 bytes
+ * lengths in front of every element: [T] [C] [L1][D1] [L2][D2]...
+ * importData() accepts both formats, exportLegacy() writes v1.
  */
 class Bundle
 {
+	friend class BundleView;
+
 public:
 	/**
 	 * @brief Default constructor
@@ -48,6 +63,19 @@ public:
 	 */
 	Bundle(const Bundle & bundle);
 
+#if __cplusplus >= 201103L
+	/**
+	 * @brief Move constructor, takes the buffer of bundle
+	 * @param bundle	source object, left empty
+	 */
+	Bundle(Bundle && bundle);
+
+	/**
+	 * @brief Move assignment operator
+	 */
+	Bundle & operator =(Bundle && bundle);
+#endif
+
 	/**
 	 * @brief Virtual destructor
 	 */
@@ -83,6 +111,23 @@ public:
 	 */
 	void putString(const std::string &s);
 
+	/**
+	 * @brief put 64 bits integer into bundle
+	 */
+	void putInt64(const int64_t &i);
+
+	/**
+	 * @brief put 64 bits unsigned integer into bundle
+	 */
+	void putUInt64(const uint64_t &i);
+
+	/**
+	 * @brief put binary data into bundle
+	 * @param data		source data
+	 * @param size		byte count
+	 */
+	void putBlob(const void * data, const int size);
+
 	/**
 	 * @brief put bundle into bundle
 	 */
@@ -103,19 +148,15 @@ public:
 	void putArray(const T * arr, const int size)
 	{
 		unsigned char type = Bundle::getType(typeid(T));
+		int width = typeWidth(type);
 
-		if (type == 0)
+		if (type == 0 || (width != 0 && (size_t) width != sizeof(T)))
 		{
 			throw std::invalid_argument("Invalid argument type");
 		}
 
-		buf[wind++] = type;
-
-		buf[wind++] = (size >> 8) & 0xFF;
-		buf[wind++] = size & 0xFF;
-
-		for (int i = 0; i < size; ++i)
-			Bundle::put(arr[i]);
+		putHeader(type, size);
+		putElements(arr, size);
 	}
 
 	/**
@@ -126,21 +167,23 @@ public:
 	void putArray(const std::vector<T> & vec)
 	{
 		unsigned char type = Bundle::getType(typeid(T));
+		int width = typeWidth(type);
 
-		if (type == 0)
+		if (type == 0 || (width != 0 && (size_t) width != sizeof(T)))
 		{
 			throw std::invalid_argument("Invalid argument type");
 		}
 
-		buf[wind++] = type;
-
-		buf[wind++] = (vec.size() >> 8) & 0xFF;
-		buf[wind++] = vec.size() & 0xFF;
-
-		for (size_t i = 0; i < vec.size(); ++i)
-			Bundle::put(vec[i]);
+		putHeader(type, vec.size());
+		putElements(vec.empty() ? NULL : &vec[0], vec.size());
 	}
 
+	/**
+	 * @brief put bool array into bundle
+	 * @param vec		source vector
+	 */
+	void putArray(const std::vector<bool> & vec);
+
 	/*
 	 * Overloading stream insertion operators for types above.
 	 */
@@ -149,6 +192,8 @@ public:
 	Bundle & operator <<(const bool &i);
 	Bundle & operator <<(const double &i);
 	Bundle & operator <<(const std::string &i);
+	Bundle & operator <<(const int64_t &i);
+	Bundle & operator <<(const uint64_t &i);
 	Bundle & operator <<(const char * i);
 	Bundle & operator <<(const Bundle &i);
 	Bundle & operator <<(const Serializable &s);
@@ -160,6 +205,12 @@ public:
 		return *this;
 	}
 
+	/**
+	 * @brief Make room for size more bytes of data
+	 * @param size		byte count
+	 */
+	void reserve(const int size);
+
 	/**
 	 * @brief Clear bundle content
 	 */
@@ -190,11 +241,34 @@ public:
 	 */
 	std::string getString();
 
+	/**
+	 * @brief Get 64 bits integer from bundle
+	 */
+	int64_t getInt64();
+
+	/**
+	 * @brief Get 64 bits unsigned integer from bundle
+	 */
+	uint64_t getUInt64();
+
+	/**
+	 * @brief Get binary data from bundle
+	 * @param blob		destination
+	 */
+	void getBlob(std::vector<unsigned char> & blob);
+
 	/**
 	 * @brief Get serializable object from bundle
 	 */
 	void getSerializable(Serializable &s);
 
+	/**
+	 * @brief Move next elements into another bundle (appended)
+	 * @param b			destination bundle
+	 * @param count		element count, runtime_error if negative or more than left
+	 */
+	void getBundle(Bundle &b, const int count);
+
 	/*
 	 * Overloading stream extraction operators for types above.
 	 */
@@ -203,6 +277,8 @@ public:
 	Bundle & operator >>(bool &i);
 	Bundle & operator >>(double &i);
 	Bundle & operator >>(std::string &i);
+	Bundle & operator >>(int64_t &i);
+	Bundle & operator >>(uint64_t &i);
 	Bundle & operator >>(Serializable &s);
 
 	template<typename T>
@@ -220,40 +296,32 @@ public:
 	template<typename T>
 	int getArray(T *& arr)
 	{
-		unsigned char type = buf[rind++];
-
-		if (type != Bundle::getType(typeid(T)))
-			throw std::invalid_argument("Invalid argument type");
-
-		uint count, len;
-
-		count = (buf[rind] << 8) | buf[rind + 1];
-		rind += 2;
+		unsigned char type = Bundle::getType(typeid(T));
+		unsigned int count;
 
-		arr = new T[count];
+		int i = header(type, count);
 
-		for (int i = 0; i < count; ++i)
+		if ((size_t) typeWidth(type) != sizeof(T))
 		{
-			len = (buf[rind] << 8) | buf[rind + 1];
-			rind += 2;
+			throw std::runtime_error("Invalid length");
+		}
 
-			if (len != sizeof(T))
-			{
-				throw std::runtime_error("Invalid length");
-			}
+		arr = new T[count];
 
-			memcpy(&(arr[i]), &(((unsigned char *) buf)[rind]), sizeof(T));
-			rind += sizeof(T);
-//			cerr << "arr[" << i << "] : " << vec[i] << endl;
-		}
+		memcpy(arr, &(((unsigned char *) buf)[i]), count * sizeof(T));
 
-		// reset indices
-		if (wind == rind)
-			wind = rind = 0;
+		consumed(i + count * sizeof(T));
 
 		return count;
 	}
 
+	/**
+	 * @brief Get bool array from bundle
+	 * @param arr	pointer to get array(not allocated)
+	 * @return		element count
+	 */
+	int getArray(bool *& arr);
+
 	/**
 	 * @brief Get string array from bundle
 	 * @param arr	pointer to get array(not allocated)
@@ -268,42 +336,30 @@ public:
 	template<typename T>
 	void getArray(std::vector<T> & vec)
 	{
-		unsigned char type = buf[rind++];
-
-		if (type != Bundle::getType(typeid(T)))
-			throw std::invalid_argument("Invalid argument type");
-
-		uint count, len;
-		T elem;
-
-		count = (buf[rind] << 8) | buf[rind + 1];
-		rind += 2;
+		unsigned char type = Bundle::getType(typeid(T));
+		unsigned int count;
 
-		vec.resize(count);
+		int i = header(type, count);
 
-		for (uint i = 0; i < count; ++i)
+		if ((size_t) typeWidth(type) != sizeof(T))
 		{
-			len = (buf[rind] << 8) | buf[rind + 1];
-			rind += 2;
-
-			if (len != sizeof(T))
-			{
-//				cerr << "len : " << len << "     sizeof(T) = " << sizeof(T) << endl;
-				throw std::runtime_error("invalid length");
-			}
+			throw std::runtime_error("invalid length");
+		}
 
-			memcpy(&elem, &(((unsigned char *) buf)[rind]), sizeof(T));
-			vec[i] = elem;
+		vec.resize(count);
 
-			rind += sizeof(T);
-//			cerr << "arr[" << i << "] : " << vec[i] << endl;
-		}
+		if (count > 0)
+			memcpy(&vec[0], &(((unsigned char *) buf)[i]), count * sizeof(T));
 
-		// reset indices
-		if (wind == rind)
-			wind = rind = 0;
+		consumed(i + count * sizeof(T));
 	}
 
+	/**
+	 * @brief Get bool array from bundle into vector
+	 * @param vec	destination vector
+	 */
+	void getArray(std::vector<bool> & vec);
+
 	/**
 	 * @brief Get string array from bundle into vector
 	 * @param vec	destination vector
@@ -312,7 +368,7 @@ public:
 
 	/**
 	 * @brief Import bundle-like formatted buffer
-	 * @param buf	source buffer
+	 * @param buf	source buffer, format v2 or v1
 	 * @param size	buffer size
 	 * @return		true if successfully done, otherwise false
 	 */
@@ -320,12 +376,28 @@ public:
 
 	/**
 	 * @brief Export formatted data into given buffer
-	 * @param buf	destination buffer
+	 * @param buf	destination buffer, byteCount() + 1 bytes for format v2
 	 * @param size	buffer size
 	 * @return		data length placed into the buffer, otherwise a negative error code
 	 */
 	int exportData(unsigned char * buf, const int size) const;
 
+	/**
+	 * @brief Export data in format v1 of old peers
+	 * @param data	destination
+	 * @return		false if content does not fit v1 (new types, 16 bits counts and lengths)
+	 */
+	bool exportLegacy(std::string & data) const;
+
+	/**
+	 * @brief Get formatted data as buffer regions without copying
+	 * @warning regions are valid until the bundle is modified
+	 * @param iov		destination regions
+	 * @param count		max region count
+	 * @return			region count, otherwise -1 if regions do not fit
+	 */
+	int exportRegions(struct iovec * iov, const int count) const;
+
 	/**
 	 * @brief Print content to the stderr as a byte order
 	 * @warning use for debug purpose
@@ -347,10 +419,10 @@ public:
 	 * @brief Element count in bundle
 	 * @return		element count
 	 */
-	int count() const;
+	inline int count() const;
 
 	/**
-	 * @brief bytes count in bundle raw data
+	 * @brief bytes count in bundle raw data (without the version byte)
 	 * @return		# of bytes
 	 */
 	int byteCount() const;
@@ -359,14 +431,20 @@ public:
 	 * @brief Get next element type
 	 * @return		next element type if available, otherwise TYPE_UNDEF
 	 */
-	unsigned char getNextType() const;
+	inline unsigned char getNextType() const;
 
 	const static unsigned char TYPE_INT = 0x01;			// singular data
 	const static unsigned char TYPE_CHAR = 0x02;
 	const static unsigned char TYPE_BOOL = 0x03;
 	const static unsigned char TYPE_DOUBLE = 0x04;
-	const static unsigned char TYPE_STRING = 0x05;
-	const static unsigned char TYPE_UNDEF = 0x06;		// must be the largest
+	const static unsigned char TYPE_STRING = 0x05;		// largest type of format v1
+	const static unsigned char TYPE_INT64 = 0x06;
+	const static unsigned char TYPE_UINT64 = 0x07;
+	const static unsigned char TYPE_BLOB = 0x08;
+	const static unsigned char TYPE_UNDEF = 0x09;		// must be the largest
+
+	/** @brief First byte of exported data in format v2, never a type */
+	const static unsigned char FORMAT_V2 = 0x82;
 
 protected:
 
@@ -378,7 +456,34 @@ protected:
 	static unsigned char getType(const std::type_info & ti);
 
 	/**
-	 * @brief Check whether given buffer is formatted like a bundle
+	 * @brief Data width of fixed width types
+	 * @param type	element type
+	 * @return		byte count (1 for a single bool), 0 for strings, blobs and unknown types
+	 */
+	static inline int typeWidth(const unsigned char type);
+
+	/**
+	 * @brief Read a LEB128 varint of at most 31 bits
+	 * @param buf	source buffer
+	 * @param size	buffer size
+	 * @param i		read index, advanced past the varint
+	 * @param value	decoded value
+	 * @return		false if varint is truncated or too large
+	 */
+	static inline bool readVarint(const unsigned char * buf, const int size,
+			int & i, unsigned int & value);
+
+	/**
+	 * @brief Find the end of an element in format v2
+	 * @param buf	source buffer
+	 * @param size	buffer size
+	 * @param i		element index
+	 * @return		index after the element, otherwise -1 if it is invalid
+	 */
+	static int skipElement(const unsigned char * buf, const int size, int i);
+
+	/**
+	 * @brief Check whether given buffer is formatted like a bundle (v2, without version byte)
 	 * @param buf	source buffer
 	 * @param size	buffer size
 	 * @return		element count if it is valid, otherwise negative error code
@@ -386,19 +491,37 @@ protected:
 	static int checkValidity(const unsigned char * buf, const int size);
 
 	/**
-	 * @brief Push argument's length and content into buffer
+	 * @brief Check whether given buffer is formatted like a bundle of format v1
+	 * @param buf	source buffer
+	 * @param size	buffer size
+	 * @return		element count if it is valid, otherwise negative error code
+	 */
+	static int checkValidityV1(const unsigned char * buf, const int size);
+
+	/**
+	 * @brief Import buffer of format v1, converted to v2
+	 * @return		true if successfully done, otherwise false
+	 */
+	bool importV1(const unsigned char * buf, const int size);
+
+	/** @brief Push a LEB128 varint into buffer */
+	void putVarint(unsigned int value);
+
+	/**
+	 * @brief Push element type and count into buffer
+	 * @param type	element type
+	 * @param count	element count
+	 */
+	void putHeader(const unsigned char type, const unsigned int count);
+
+	/**
+	 * @brief Push argument's content into buffer
 	 * @param t		source variable
 	 */
 	template<typename T>
 	void put(const T & t)
 	{
-		// length
-		size_t size = sizeof(T);
-		buf[wind++] = (size >> 8) & 0xFF;
-		buf[wind++] = size & 0xFF;
-
-		// resize buffer
-		buf[wind + sizeof(T)] = 0;
+		buf.reserve(wind + sizeof(T));
 
 		// data
 		memcpy(&(((unsigned char *) buf)[wind]), &t, sizeof(T));
@@ -413,45 +536,72 @@ protected:
 	void put(const std::string & s);
 
 	/**
-	 * @brief Pop element from the buffer
-	 * @param t		destination variable
+	 * @brief Push array elements into buffer at once
+	 * @param arr	source array of a fixed width type
+	 * @param count	element count
 	 */
 	template<typename T>
-	void get(T & t)
+	void putElements(const T * arr, const int count)
 	{
-		unsigned char type = buf[rind++];
-		ushort count, length;
+		buf.reserve(wind + count * sizeof(T));
 
-		count = (buf[rind] << 8) | buf[rind + 1];
-		rind += 2;
+		if (count > 0)
+			memcpy(&(((unsigned char *) buf)[wind]), arr, count * sizeof(T));
 
-		length = (buf[rind] << 8) | buf[rind + 1];
-		rind += 2;
+		wind += count * sizeof(T);
+	}
+
+	/**
+	 * @brief Push bools into buffer packed into bits
+	 */
+	void putElements(const bool * arr, const int count);
+
+	/**
+	 * @brief Push strings into buffer with their lengths
+	 */
+	void putElements(const std::string * arr, const int count);
+
+	/**
+	 * @brief Check header of the next element
+	 * @param type	expected type
+	 * @param count	element count
+	 * @return		index of element data
+	 */
+	int header(const unsigned char type, unsigned int & count) const;
 
+	/**
+	 * @brief Finish reading the next element
+	 * @param end	index after the element
+	 */
+	void consumed(const int end);
+
+	/**
+	 * @brief Pop element from the buffer
+	 * @param t		destination variable
+	 */
+	template<typename T>
+	void get(T & t)
+	{
 		unsigned char argType = getType(typeid(T));
+		unsigned int count;
 
-		if (type != argType || count != 1 || length != sizeof(T))
+		int i = header(argType, count);
+
+		if (count != 1 || (size_t) typeWidth(argType) != sizeof(T))
 			throw std::runtime_error("invalid operation");
 
 		switch (argType)
 		{
-		case TYPE_INT:
-		case TYPE_CHAR:
-		case TYPE_DOUBLE:
-			memcpy(&t, &(((unsigned char *) buf)[rind]), sizeof(T));
-			rind += sizeof(T);
+		case TYPE_BOOL:
+			t = (buf[i] & 0x01);
 			break;
 
-		case TYPE_BOOL:
-			t = (buf[rind++] != 0);
+		default:
+			memcpy(&t, &(((unsigned char *) buf)[i]), sizeof(T));
 			break;
 		}
 
-		// reset indices
-		if (wind == rind)
-			wind = rind = 0;
-
-		rearrange();
+		consumed(i + sizeof(T));
 	}
 
 	/**
@@ -468,6 +618,72 @@ protected:
 	AutoResizingBuf<unsigned char> buf;
 	int wind; /** write index */
 	int rind; /** read index */
+	int elements; /** element count not read yet, kept as elements are put and read */
 };
 
+inline int Bundle::count() const
+{
+	return elements;
+}
+
+inline unsigned char Bundle::getNextType() const
+{
+	return (elements > 0) ? buf[rind] : TYPE_UNDEF;
+}
+
+inline int Bundle::typeWidth(const unsigned char type)
+{
+	switch (type)
+	{
+	case TYPE_INT:
+		return sizeof(int32_t);
+
+	case TYPE_CHAR:
+	case TYPE_BOOL:
+		return 1;
+
+	case TYPE_DOUBLE:
+		return sizeof(double);
+
+	case TYPE_INT64:
+	case TYPE_UINT64:
+		return sizeof(int64_t);
+
+	default:
+		return 0;
+	}
+}
+
+inline bool Bundle::readVarint(const unsigned char * buf, const int size,
+		int & i, unsigned int & value)
+{
+	// counts and short lengths fit one byte
+	if (i < size && buf[i] < 0x80)
+	{
+		value = buf[i++];
+		return true;
+	}
+
+	value = 0;
+
+	for (int shift = 0; shift < 32; shift += 7)
+	{
+		if (i >= size)
+			return false;
+
+		unsigned char b = buf[i++];
+
+		// 5th byte holds bits 28..30 only
+		if (shift == 28 && b > 0x07)
+			return false;
+
+		value |= (unsigned int) (b & 0x7F) << shift;
+
+		if (!(b & 0x80))
+			return true;
+	}
+
+	return false;
+}
+
 #endif /* BUNDLE_H_ */
@@ -0,0 +1,232 @@
+#ifndef BUNDLEVIEW_H_
+#define BUNDLEVIEW_H_
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Bundle.h"
+
+/**
+ * @brief Read-only Bundle decoder over a buffer it does not own
+ *
+ * Elements are decoded in place, nothing is copied into the view. The
+ * buffer is validated once when the view is set, element count and next
+ * type are known without scanning the buffer again.
+ *
+ * Strings can be read as a pointer and length into the buffer, and a run
+ * of elements as another view (e.g. commands of a BATCH request).
+ *
+ * @warning the buffer must outlive the view
+ */
+class BundleView
+{
+public:
+	/**
+	 * @brief Create an empty view
+	 */
+	BundleView();
+
+	/**
+	 * @brief Create a view of a buffer
+	 * @param buf		bundle formatted buffer (format v2)
+	 * @param size		buffer size
+	 * @see BundleView::set
+	 */
+	BundleView(const unsigned char * buf, const int size);
+
+	/**
+	 * @brief Virtual destructor
+	 */
+	virtual ~BundleView();
+
+	/**
+	 * @brief View another buffer
+	 * @param buf		data exported by Bundle (format v2)
+	 * @param size		buffer size
+	 * @return			false if buffer is not bundle formatted (view is cleared)
+	 */
+	bool set(const unsigned char * buf, const int size);
+
+	/**
+	 * @brief Drop the viewed buffer
+	 */
+	void clear();
+
+	/**
+	 * @brief Get integer from bundle
+	 */
+	int getInt();
+
+	/**
+	 * @brief Get char from bundle
+	 */
+	char getChar();
+
+	/**
+	 * @brief Get bool from bundle
+	 */
+	bool getBool();
+
+	/**
+	 * @brief Get double from bundle
+	 */
+	double getDouble();
+
+	/**
+	 * @brief Get string from bundle
+	 */
+	std::string getString();
+
+	/**
+	 * @brief Get string from bundle without copying it
+	 * @param data		string data in the viewed buffer, not NUL terminated
+	 * @param length	string length
+	 */
+	void getString(const char *& data, int & length);
+
+	/**
+	 * @brief Get 64 bits integer from bundle
+	 */
+	int64_t getInt64();
+
+	/**
+	 * @brief Get 64 bits unsigned integer from bundle
+	 */
+	uint64_t getUInt64();
+
+	/**
+	 * @brief Get binary data from bundle without copying it
+	 * @param data		data in the viewed buffer
+	 * @param size		byte count
+	 */
+	void getBlob(const unsigned char *& data, int & size);
+
+	/**
+	 * @brief Get array from bundle into vector, copied at once
+	 * @param vec		destination vector
+	 */
+	template<typename T>
+	void getArray(std::vector<T> & vec)
+	{
+		unsigned char type = Bundle::getType(typeid(T));
+
+		if ((size_t) Bundle::typeWidth(type) != sizeof(T))
+			throw std::runtime_error("invalid length");
+
+		unsigned int count = array(type);
+
+		vec.resize(count);
+
+		if (count > 0)
+			::memcpy(&vec[0], buf + rind, count * sizeof(T));
+
+		rind += count * sizeof(T);
+	}
+
+	/**
+	 * @brief Get bool array from bundle into vector
+	 * @param vec		destination vector
+	 */
+	void getArray(std::vector<bool> & vec);
+
+	/**
+	 * @brief Get string array from bundle into vector
+	 * @param vec		destination vector
+	 */
+	void getArray(std::vector<std::string> & vec);
+
+	/**
+	 * @brief Get char array from bundle without copying it
+	 * @param data		array data in the viewed buffer
+	 * @param count		element count
+	 */
+	void getArray(const char *& data, int & count);
+
+	/**
+	 * @brief Get next elements as a view of the same buffer
+	 * @param view		destination view
+	 * @param count		element count, runtime_error if negative or more than left
+	 */
+	void getView(BundleView & view, const int count);
+
+	/*
+	 * Overloading stream extraction operators for types above.
+	 */
+	BundleView & operator >>(int &i);
+	BundleView & operator >>(char &i);
+	BundleView & operator >>(bool &i);
+	BundleView & operator >>(double &i);
+	BundleView & operator >>(std::string &i);
+	BundleView & operator >>(int64_t &i);
+	BundleView & operator >>(uint64_t &i);
+
+	/**
+	 * @brief Element count not read yet
+	 */
+	inline int count() const;
+
+	/**
+	 * @brief Byte count not read yet
+	 */
+	inline int byteCount() const;
+
+	/**
+	 * @brief Get next element type
+	 * @return		next element type if available, otherwise Bundle::TYPE_UNDEF
+	 */
+	inline unsigned char getNextType() const;
+
+	/**
+	 * @brief Copy unread elements into a bundle
+	 */
+	void toBundle(Bundle & bundle) const;
+
+	/**
+	 * @brief Get string representation (new-lines between elements)
+	 */
+	std::string toString() const;
+
+protected:
+	/**
+	 * @brief Begin reading a single element of given type
+	 * @param type		expected type
+	 * @return			element data length
+	 */
+	int next(const unsigned char type);
+
+	/**
+	 * @brief Begin reading an array of given type
+	 * @param type		expected type
+	 * @return			element count
+	 */
+	unsigned int array(const unsigned char type);
+
+	/** @brief Skip count elements, return the offset after them */
+	int skip(const int count) const;
+
+	const unsigned char * buf;
+	int size;
+	/** read index */
+	int rind;
+	/** elements not read yet */
+	int elements;
+};
+
+inline int BundleView::count() const
+{
+	return elements;
+}
+
+inline int BundleView::byteCount() const
+{
+	return size - rind;
+}
+
+inline unsigned char BundleView::getNextType() const
+{
+	return (elements > 0) ? buf[rind] : Bundle::TYPE_UNDEF;
+}
+
+#endif /* BUNDLEVIEW_H_ */
@@ -1,6 +1,14 @@
 #ifndef SERVICE_CLIENT_H_
 #define SERVICE_CLIENT_H_
 
+#include <deque>
+#include <istream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <ipc/AsyncClient.h>
+
 class service_client
 {
 public:
@@ -9,6 +17,69 @@ public:
 	static void exit_with_usage(int exit_code);
 
 	int process(int argc, char * argv[]);
+
+protected:
+	/** @brief Command line of a daemon request */
+	struct command_line
+	{
+		std::string command;
+		/** arguments after the command */
+		std::vector<std::string> args;
+		Bundle request;
+		/** response timeout in milliseconds */
+		long long timeout;
+		/** START/STOP/RESTART, response has per service results */
+		bool bulk;
+		/** SHOW of several services in one BATCH request */
+		bool batch;
+		/** plain LIST, the status board can answer */
+		bool from_board;
+	};
+
+	/**
+	 * @brief Parse command and arguments into a request
+	 * @param args		command and its arguments
+	 * @return			false if command or arguments are invalid
+	 */
+	static bool parse(const std::vector<std::string> & args, command_line & cl);
+
+	/**
+	 * @brief Wait for the response of a submitted request and print it
+	 * @return			exit code
+	 */
+	static int print_response(const command_line & cl, AsyncClient & c,
+			uint32_t request_id);
+
+	/**
+	 * @brief Print responses of pending requests in order until keep of them are left
+	 * @return			exit code, 1 if a request failed
+	 */
+	static int print_pending(AsyncClient & c,
+			std::deque<std::pair<command_line, uint32_t> > & pending,
+			const size_t keep);
+
+	/**
+	 * @brief Run commands read line by line over one connection (batch mode)
+	 *
+	 * Requests are pipelined and responses printed in input order. A command
+	 * after start/stop/restart other than another start/stop/restart waits
+	 * for them, so it sees their effect.
+	 *
+	 * @return			exit code, 1 if a command failed
+	 */
+	static int run_session(std::istream & in);
+
+	/**
+	 * @brief Print plain LIST from the daemon's status board
+	 * @return			false if board is not available or incomplete
+	 */
+	static bool print_list_from_board();
+
+	/**
+	 * @brief Print STATUS of services, from the status board or by pipelined queries
+	 * @return			exit code
+	 */
+	static int print_status(const std::vector<std::string> & names);
 };
 
 #endif /* SERVICE_CLIENT_H_ */
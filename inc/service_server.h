@@ -1,12 +1,21 @@
 #ifndef SERVICESERVER_H_
 #define SERVICESERVER_H_
 
+#include <deque>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <time.h>
 
 #include "service_t.h"
 #include "ipc/ipc.h"
 #include "Debug.h"
+#include "TimerWheel.h"
+#include "script_cache.h"
+#include "status_board.h"
 
 class service_server
 {
@@ -18,9 +27,69 @@ public:
 
 protected:
 
-	enum RunState
+	typedef void (service_server::*event_handler)(int fd, uint32_t events);
+
+	/** @brief timer types in the timer wheel */
+	enum TimerType
+	{
+		TT_RESPAWN = 1, TT_STOP_DEADLINE
+	};
+
+	/** @brief result of a service operation (start, stop, restart) */
+	enum OperationResult
+	{
+		OP_OK, OP_FAILED,
+		/** completes later, see complete() */
+		OP_PENDING
+	};
+
+	typedef OperationResult (service_server::*operation)(
+			const std::string & name, std::string & error);
+
+	/** @brief client waiting for a service transition */
+	struct waiter
 	{
-		RS_INIT = 0, RS_SERVICE_CHECK, RS_SERVICE_RESPAWN, RS_HANDLE_COMMAND
+		std::string client;
+		/** bulk request id, 0 if the client waits for a single service */
+		int request_id;
+	};
+
+	/** @brief operation waiting for the previous operation on its service */
+	struct pending_operation
+	{
+		operation op;
+		waiter w;
+	};
+
+	/** @brief START/STOP/RESTART of several services with bounded parallelism */
+	struct bulk_request
+	{
+		std::string client;
+		operation op;
+		/** max operations in progress, never 0 (0 requested means SERVICE_BULK_JOBS) */
+		size_t jobs;
+		/** services ready to be processed (dependencies completed) */
+		std::deque<std::string> queue;
+		/** services with pending operations */
+		std::set<std::string> in_flight;
+		/** selected services in reply order */
+		std::vector<std::string> names;
+		/** success and error message of completed operations */
+		std::map<std::string, std::pair<bool, std::string> > results;
+
+		/** uncompleted dependencies of services not queued yet */
+		std::map<std::string, int> blockers;
+		/** services waiting for a service to complete */
+		std::map<std::string, std::vector<std::string> > dependents;
+		/** required dependencies of services, their failure fails the service */
+		std::map<std::string, std::set<std::string> > required;
+
+		/** request start time, see Timer::getCurrentClock() */
+		uint64_t started;
+		/** completion time of services in milliseconds since start */
+		std::map<std::string, uint64_t> finished;
+		/** dependency completed last, i.e. the one the service waited for */
+		std::map<std::string, std::string> critical;
 	};
 
 	static const std::string dirpath_service;
@@ -32,38 +101,349 @@ protected:
 	/** @brief save service list file */
 	void save_service_list();
 
-	void handle_START(Bundle & bundle);
-	void handle_STOP(Bundle & bundle);
-	void handle_RESTART(Bundle & bundle);
-	void handle_STATUS(Bundle & bundle);
-	void handle_SHOW(Bundle & bundle);
-	void handle_LIST(Bundle & bundle);
+	/**
+	 * @brief Handle START/STOP/RESTART of one service or of several services
+	 *
+	 * Single service request : [name], reply : [true] or [false, error],
+	 *                          dependencies are not resolved
+	 * Bulk request           : [jobs, name or pattern...],
+	 *                          reply : [all succeeded, count, (name, ok, error)...,
+	 *                                   critical path]
+	 */
+	void handle_lifecycle(BundleView & bundle, operation op);
+
+	OperationResult start_operation(const std::string & name, std::string & error);
+	OperationResult stop_operation(const std::string & name, std::string & error);
+	OperationResult restart_operation(const std::string & name, std::string & error);
+
+	/**
+	 * @brief Resolve service names and glob patterns to service names
+	 * @param selectors	service names or fnmatch() patterns
+	 * @param names		matching service names, unique, in selector order
+	 * @param unmatched	patterns without any matching service
+	 */
+	void select_services(const std::vector<std::string> & selectors,
+			std::vector<std::string> & names, std::vector<std::string> & unmatched);
+
+	/**
+	 * @brief Import configs of all services, cached while the service directory is watched
+	 * @return			configs by service name
+	 */
+	const std::map<std::string, config_t> & load_dependencies();
+
+	/**
+	 * @brief Check requires/after of given services for cycles
+	 *
+	 * Dependencies outside names are not followed, they are not ordered.
+	 *
+	 * @param configs	configs by service name
+	 * @param names		services to check
+	 * @param error		cycle description if found
+	 * @return			false if dependencies have a cycle
+	 */
+	bool check_dependencies(const std::map<std::string, config_t> & configs,
+			const std::set<std::string> & names, std::string & error);
+
+	/**
+	 * @brief Order operations of a bulk request by dependencies and queue the ready ones
+	 *
+	 * Services are started (or restarted) after their selected dependencies and
+	 * stopped before them. START also selects required services.
+	 */
+	void plan_bulk(bulk_request & r, const std::map<std::string, config_t> & configs);
+
+	/** @brief Run queued operations of a bulk request up to its job limit, reply when all completed */
+	void bulk_step(int request_id);
+
+	/** @brief Id for a bulk or batch request, positive and not in use */
+	int allocate_request_id();
+
+	/** @brief Record result of a bulk operation, unblock or fail its dependents */
+	void bulk_done(bulk_request & r, const std::string & name, bool ok,
+			const std::string & error);
+
+	/** @brief Dependency chain that completed last, e.g. "a (2 ms) -> b (5 ms)", empty if no dependency */
+	static std::string critical_path(const bulk_request & r);
+
+	void handle_START(BundleView & bundle);
+	void handle_STOP(BundleView & bundle);
+	void handle_RESTART(BundleView & bundle);
+	void handle_STATUS(BundleView & bundle);
+	void handle_SHOW(BundleView & bundle);
+	void handle_LIST(BundleView & bundle);
+
+	/**
+	 * @brief Run several commands, reply all results at once
+	 *
+	 * Request : [count, (element count, command, arguments...)...],
+	 * reply   : [true, count, (element count, command reply...)...] in request
+	 *           order, when the last command completes. Streaming commands
+	 *           (LIST, SUBSCRIBE) and nested batches are rejected.
+	 */
+	void handle_BATCH(BundleView & bundle);
+
+	/** @brief BATCH in progress */
+	struct batch_request
+	{
+		std::string client;
+		/** replies of the commands, by command index */
+		std::vector<Bundle> replies;
+		/** commands not replied yet */
+		size_t remaining;
+	};
+
+	/**
+	 * @brief Reply a client, or record the reply if client is a command of a batch
+	 * @return			false if reply could not be sent
+	 */
+	bool send(const std::string & client, const Bundle & response);
+
+	/** @brief Reply batch if all of its commands are replied */
+	void finish_batch(int batch_id);
+
+	/**
+	 * @brief Register client for lifecycle events
+	 *
+	 * Request : [name or pattern...], all services if none,
+	 * reply   : [true], then events : [true, dropped, time, event, name, pid, value]
+	 */
+	void handle_SUBSCRIBE(BundleView & bundle);
+
+	/** @brief LIST response in progress */
+	struct list_stream
+	{
+		/** last service sent, next one follows it in name order */
+		std::string cursor;
+		/** services left in the page, -1 if unlimited */
+		int remaining;
+		/** field mask of records, 0 for full service records */
+		int fields;
+	};
+
+	/** @brief Re-read service config names if the service directory changed */
+	void refresh_config_names();
+
+	/**
+	 * @brief Next service (running service or config file) in name order
+	 * @param cursor	previous service name, empty for the first service
+	 * @param name		next service name
+	 * @return			false if there is no service after cursor
+	 */
+	bool next_service_name(const std::string & cursor, std::string & name) const;
+
+	/**
+	 * @brief Write service record (running service or last run of a stopped service)
+	 * @param fields	field mask, 0 for the full service record
+	 * @return			false if service can not be found
+	 */
+	bool write_service(Bundle & response, const std::string & name, int fields);
+
+	/** @brief Send next chunks of LIST responses while their clients keep up */
+	void continue_streams();
+
+	/** @brief Client registered for lifecycle events */
+	struct subscriber
+	{
+		/** service names or fnmatch() patterns, all services if empty */
+		std::vector<std::string> selectors;
+		/** events not handed to the connection yet, at most SERVICE_WATCH_QUEUE */
+		std::deque<Bundle> queue;
+		/** events dropped since subscription because the queue was full */
+		int dropped;
+	};
+
+	/**
+	 * @brief Update status board and queue lifecycle event for subscribers of the service
+	 * @param event		event name, see SERVICE_EVENT_*
+	 * @param name		service name
+	 * @param pid		process id, -1 if none
+	 * @param value		exit code, signal or respawn delay in milliseconds
+	 */
+	void publish(const char * event, const std::string & name, pid_t pid,
+			int value = 0);
+
+	/** @brief Send queued events while subscribers keep up, drop gone subscribers */
+	void flush_events();
+
+	/** @brief Write status of a service to the status board, release its slot if it is gone */
+	void update_status(const std::string & name);
+
+	/** @brief Write status of all services (running, stopped and configured) to the status board */
+	void sync_status();
+
+	/** @brief drop dead services and set up respawn timers */
+	void check_services();
+
+	/**
+	 * @brief Set up respawn timer of a dead service or retire it
+	 * @return			true if service is retired (service list must be saved)
+	 */
+	bool check_service(std::map<std::string, service_t>::iterator it);
+
+	/** @brief Move service to stopped services */
+	void retire(std::map<std::string, service_t>::iterator it);
+
+	/** @brief start service whose respawn timer expired */
+	void respawn_service(const std::string & name, TimerWheel::timer_id id);
+
+	/**
+	 * @brief Add file descriptor to the epoll set
+	 * @param fd		file descriptor to watch
+	 * @param events	epoll events (EPOLLIN etc.)
+	 * @param handler	member function called when fd is ready
+	 * @return			true if successfully added, otherwise false
+	 */
+	bool watch(int fd, uint32_t events, event_handler handler);
 
-	/** @brief get all services */
-	bool get_all_services(std::map<std::string, service_t> & all_services);
+	/** @brief Remove file descriptor from the epoll set */
+	void unwatch(int fd);
+
+	/** @brief Watch service pidfd for exit events, map its pid for SIGCHLD */
+	void supervise(service_t & s);
+	/** @brief Stop watching service pidfd, forget its pid */
+	void unsupervise(service_t & s);
+
+	void on_ipc_event(int fd, uint32_t events);
+	void on_timer_event(int fd, uint32_t events);
+	void on_pidfd_event(int fd, uint32_t events);
+	/** @brief onstop command of a stopped service exited */
+	void on_onstop_event(int fd, uint32_t events);
+	void on_sigchld_event(int fd, uint32_t events);
+	/** @brief Service config added, removed or renamed */
+	void on_config_dir_event(int fd, uint32_t events);
+
+	/** @brief Mark service as exited, complete stop or set up respawn */
+	void service_exited(std::map<std::string, service_t>::iterator it);
+
+	/** @brief Send stop signal and arm stop deadline */
+	bool begin_stop(std::map<std::string, service_t>::iterator it);
+
+	/** @brief Stop timeout expired: SIGKILL, or give up if already killed */
+	void stop_deadline(const std::string & name, TimerWheel::timer_id id);
+
+	/** @brief Service exited after STOP/RESTART: run onstop, then stop_finished() */
+	void stop_completed(std::map<std::string, service_t>::iterator it);
+
+	/** @brief Restart or retire stopped service and reply */
+	void stop_finished(std::map<std::string, service_t>::iterator it);
+
+	/**
+	 * @brief Import config and start service, replaces existing entry
+	 * @param name		service name
+	 * @param error		error message if failed
+	 * @return			true if started
+	 */
+	bool start_service(const std::string & name, std::string & error);
+
+	/**
+	 * @brief Defer reply until the service transition completes
+	 * @param name		service name
+	 * @param request_id	bulk request id, 0 for the current client
+	 */
+	void wait(const std::string & name, int request_id = 0);
+
+	/**
+	 * @brief Run an operation, or queue it behind the operation in progress
+	 *
+	 * Operations on a service are serialized: an operation is queued while
+	 * clients wait for the previous one (or its onstop command runs) and
+	 * started by complete(). The caller does not wait() for OP_PENDING.
+	 *
+	 * @param request_id	bulk request id, 0 for the current client
+	 */
+	OperationResult begin_operation(const std::string & name, operation op,
+			std::string & error, int request_id = 0);
+
+	/** @brief True if an operation on the service is in progress */
+	bool busy(const std::string & name) const;
+
+	/** @brief Run queued operations of a service until one is pending */
+	void run_queued(const std::string & name);
+
+	/** @brief Reply all clients and bulk requests waiting for service, run queued operations */
+	void complete(const std::string & name, bool ok, const std::string & error = "");
+
+	/** @brief Reply a client or a bulk request waiting for service */
+	void reply_waiter(const waiter & w, const std::string & name, bool ok,
+			const std::string & error);
 
 	void init();
 	void finalize();
 
 	void config_init();
 
+	void reactor_init();
+	void reactor_finalize();
+
+	/** @brief Become child subreaper and watch SIGCHLD with a signalfd */
+	void reaper_init();
+	void reaper_finalize();
+
 	void ipc_init();
 	void ipc_finalize();
 
+	/** @brief Create status board and watch service directory for config changes */
+	void status_init();
+	void status_finalize();
+
 	void handler_init();
 
-	RunState run_state;
+	/** @brief epoll set of all event sources */
+	int epoll_fd;
+	/** @brief respawn and deadline timers */
+	TimerWheel timers;
+	/** @brief signalfd for SIGCHLD */
+	int sigchld_fd;
+	/** @brief inotify fd watching the service directory, -1 if not watched */
+	int config_watch_fd;
+	/** @brief status of services shared with clients */
+	status_board board;
+	/** @brief script bodies of script services as sealed memfds */
+	script_cache scripts;
+	std::map<int, event_handler> event_handlers;
 
 	std::string filepath_service_list;
 
 	DomainServer domain_server;
 	std::string client_address;
-	Bundle bundle;
+	BundleView bundle;
 
 	std::map<std::string, service_t> running_services;
+	/** @brief last run of stopped services (exit status, resource usage) */
+	std::map<std::string, service_t> stopped_services;
+	/** @brief pidfd to service name */
+	std::map<int, std::string> pidfd_services;
+	/** @brief service process pid to service name, for reaping on SIGCHLD */
+	std::map<pid_t, std::string> pid_services;
+	/** @brief onstop command pidfd to service name */
+	std::map<int, std::string> onstop_services;
+	/** @brief clients waiting for a service transition, by service name */
+	std::map<std::string, std::vector<waiter> > waiters;
+	/** @brief operations waiting for the operation in progress, by service name */
+	std::map<std::string, std::deque<pending_operation> > queued_operations;
+	/** @brief names of service config files */
+	std::set<std::string> config_names;
+	/** @brief modification time of service directory when config_names was read */
+	struct timespec config_dir_mtime;
+	/** @brief configs of all services for dependency ordering */
+	std::map<std::string, config_t> dependency_configs;
+	/** @brief dependency_configs is up to date, cleared on service directory changes */
+	bool dependencies_loaded;
+	/** @brief LIST responses in progress, by client */
+	std::map<std::string, list_stream> streams;
+	/** @brief lifecycle event subscribers, by client */
+	std::map<std::string, subscriber> subscribers;
+	/** @brief BATCH requests in progress, by id */
+	std::map<int, batch_request> batches;
+	/** @brief reply address of commands of batches: (batch id, command index) */
+	std::map<std::string, std::pair<int, size_t> > batch_slots;
+	/** @brief bulk requests in progress, by id */
+	std::map<int, bulk_request> bulk_requests;
+	/** @brief next bulk/batch request id, see allocate_request_id() */
+	int next_request_id;
 	Debug debug;
 
-	std::map<std::string, void (service_server::*)(Bundle &)> command_handlers;
+	std::map<std::string, void (service_server::*)(BundleView &)> command_handlers;
 };
 
 #endif /* SERVICESERVER_H_ */
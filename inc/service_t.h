@@ -4,54 +4,194 @@
 #include <string>
 #include <ostream>
 
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <serializer/Serializable.h>
-#include <Timer.h>
+#include <TimerWheel.h>
 
 #include "config_t.h"
+#include "script_cache.h"
 
 class service_t: public Serializable
 {
 	friend std::ostream & operator <<(std::ostream & o, const service_t & s);
 public:
+	/** @brief Lifecycle states, advanced by the daemon's event loop */
+	enum State
+	{
+		/** no process */
+		ST_STOPPED = 0,
+		/** restarted, previous run exited, waiting for its onstop to finish */
+		ST_STARTING,
+		ST_RUNNING,
+		/** stop signal sent, waiting for exit until stop timeout */
+		ST_STOPPING,
+		/** SIGKILL sent after stop timeout */
+		ST_KILLING
+	};
+
+	/** @brief Fields of projected records, see write_fields() */
+	enum Field
+	{
+		F_NAME = 1 << 0,
+		F_STATE = 1 << 1,
+		F_PID = 1 << 2,
+		F_RESPAWN_COUNT = 1 << 3,
+		F_EXIT_CODE = 1 << 4,
+		F_EXIT_SIGNAL = 1 << 5,
+		F_CPU_TIME = 1 << 6,
+		F_MAX_RSS = 1 << 7,
+		F_EXEC = 1 << 8,
+		F_LOG = 1 << 9,
+		F_PIDFILE = 1 << 10
+	};
+
+	/** @brief fields read from the config file */
+	static const int CONFIG_FIELDS = F_EXEC | F_LOG | F_PIDFILE;
+
 	service_t();
 
-	bool start();
+	/**
+	 * @brief Start service process
+	 * @param scripts	compiled scripts of the daemon, used for script services
+	 * @return			true if service process is started
+	 */
+	bool start(script_cache & scripts);
+
+	/**
+	 * @brief Send stop signal (cfg.stop_signal), state becomes ST_STOPPING
+	 * @return			true if signal is sent
+	 * @note			does not wait, exit is delivered by the daemon's pidfd/SIGCHLD events
+	 */
 	bool stop();
 
+	/**
+	 * @brief Send SIGKILL, state becomes ST_KILLING
+	 * @return			true if signal is sent
+	 */
+	bool kill();
+
+	/** @brief True if process is alive (running, stopping or killing), no syscall */
 	bool is_running() const;
 
+	/** @brief Human readable state name */
+	static const char * state_name(State state);
+
+	/**
+	 * @brief Parse comma separated field names (e.g. "name,pid,state")
+	 * @return			field mask (name always included), -1 if a name is unknown
+	 */
+	static int parse_fields(const std::string & fields);
+
+	/** @brief Write selected fields in Field order */
+	void write_fields(Bundle & bundle, int fields) const;
+
+	/** @brief Read fields written by write_fields() */
+	void read_fields(Bundle & bundle, int fields);
+
+	/** @brief Selected fields except name as "field=value ..." */
+	std::string fields_to_string(int fields) const;
+
 	bool import(const std::string & filepath);
 
+	/**
+	 * @brief Track an already running process (e.g. loaded from service list)
+	 * @param pid		process id
+	 * @return			true if process exists and pidfd is opened
+	 */
+	bool attach(pid_t pid);
+
+	/** @brief Mark process as exited (ST_STOPPED) and release its pidfd */
+	void on_exit();
+
+	/**
+	 * @brief Reap exited process and record its exit status
+	 * @return			true if process was a child and reaped
+	 * @note			non-child processes (adopted from service list) can not be reaped,
+	 * 					exit status is recorded as unknown
+	 */
+	bool reap();
+
+	/**
+	 * @brief Record exit status and resource usage of the last run
+	 * @param status	wait status, see wait4()
+	 * @param ru		resource usage or NULL if unknown
+	 */
+	void set_exit_status(int status, const struct rusage * ru);
+
 //protected:
 	static const std::string default_shell;
 
 	/**
-	 * @brief Create a daemon process and start service;
-	 * @return true if fork successful
-	 * @warning Only parent process returns
+	 * @brief Spawn service process with posix_spawn() in a new session
+	 * @param scripts	compiled scripts of the daemon, used for script services
+	 * @return true if service process is started (exec succeeded), pid is set
 	 */
-	bool daemonize();
+	bool spawn(script_cache & scripts);
 
-	/** @brief Redirect std fds and close opened files/sockets (inherited from parent process) */
-	void redirect_fds();
+	/**
+	 * @brief Open log file for the service process and log start
+	 * @return			fd (close-on-exec) or -1 if logging is disabled or failed
+	 */
+	int open_log();
 
 	/** @brief Clear members */
 	void clear();
 
-	void on_post_start();
+	/** @brief Open pidfd for current pid */
+	bool open_pidfd();
+	/** @brief Close pidfd if opened */
+	void close_pidfd();
+
+	/** @brief Remove pid file and log stop */
 	void on_post_stop();
 
+	/**
+	 * @brief Spawn onstop command (cfg.onstop_exec) without waiting for it
+	 * @return			true if onstop is running, onstop_pidfd gets readable when it exits
+	 */
+	bool run_onstop();
+
+	/** @brief Reap onstop command and release its pidfd */
+	void onstop_exited();
+
 	virtual void writeToBundle(Bundle & bundle) const;
 	virtual void readFromBundle(Bundle & bundle);
 
 	config_t cfg;
 	pid_t pid;
 
+	/** @brief process file descriptor, readable when the process exits */
+	int pidfd;
+	State state;
+
+	/** @brief start again when stop completes */
+	bool restart_pending;
+	/** @brief pending stop/kill deadline in the daemon's timer wheel, 0 if none */
+	TimerWheel::timer_id stop_timer;
+
+	/** @brief exit code of the last run, -1 if unknown or killed */
+	int exit_code;
+	/** @brief terminating signal of the last run, 0 if exited normally */
+	int exit_signal;
+	/** @brief user + system cpu time of the last run in seconds */
+	double cpu_time;
+	/** @brief max resident set size of the last run in kilobytes */
+	int max_rss;
+
+	/** @brief start time of the current or last run, 0 if unknown */
+	time_t start_time;
+
 	int respawn_count;
-	Timer respawn_timer;
-	bool respawn_timer_enabled;
+	/** @brief pending respawn timer in the daemon's timer wheel, 0 if none */
+	TimerWheel::timer_id respawn_timer;
+
+	/** @brief running onstop command, -1 if none */
+	pid_t onstop_pid;
+	/** @brief process file descriptor of the onstop command */
+	int onstop_pidfd;
 };
 
 #endif /* SERVICE_T_H_ */
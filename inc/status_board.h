@@ -0,0 +1,237 @@
+#ifndef STATUS_BOARD_H_
+#define STATUS_BOARD_H_
+
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <time.h>
+
+/**
+ * @brief Status table of services in a shared file mapping
+ *
+ * The daemon publishes one fixed-size slot per service (name, pid, state,
+ * respawn count, last exit code and start time) into a file on the runtime
+ * tmpfs. Clients map it read-only and answer STATUS and plain LIST without
+ * a request to the daemon.
+ *
+ * Slots are protected by a seqlock: the writer makes the slot sequence odd,
+ * updates the slot and makes it even again; a reader copies the slot and
+ * retries if the sequence was odd or changed meanwhile. There is only one
+ * writer (the daemon), readers never block it. A reader that keeps seeing a
+ * slot being written checks whether the daemon is still alive and gives up
+ * the board if it died in the middle of the write, see abandoned().
+ *
+ * Slots form an open addressing hash table (FNV-1a of the name, linear
+ * probing), a lookup touches the header and the pages of a few slots only.
+ * When the table gets 3/4 full the daemon writes a board of double size
+ * and renames it over the old one; readers that have the old board mapped
+ * keep reading it.
+ */
+class status_board
+{
+public:
+	/** @brief Copy of a service slot */
+	struct status
+	{
+		std::string name;
+		pid_t pid;
+		/** service_t::State */
+		int state;
+		int respawn_count;
+		/** exit code of the last run, -1 if unknown or killed */
+		int exit_code;
+		/** start time of the current or last run, 0 if never started */
+		time_t start_time;
+	};
+
+	status_board();
+
+	/**
+	 * @brief Virtual destructor, unmaps the board
+	 */
+	virtual ~status_board();
+
+	/**
+	 * @brief Create (replace) the board file and map it for writing (daemon)
+	 * @param path		board file path
+	 * @param capacity	slot count, power of two
+	 * @return			true if successfully created, otherwise false
+	 */
+	bool create(const std::string & path,
+			const size_t capacity = default_capacity);
+
+	/**
+	 * @brief Map an existing board read-only (client)
+	 * @param path		board file path
+	 * @return			false if board does not exist, is invalid or its daemon is gone
+	 */
+	bool open(const std::string & path);
+
+	/**
+	 * @brief Unmap the board
+	 */
+	void close();
+
+	/**
+	 * @brief Check whether board is mapped
+	 */
+	inline bool is_open() const;
+
+	/**
+	 * @brief Write status of a service, allocates a slot for a new service
+	 * @return			false if name does not fit a slot or the board can not grow
+	 */
+	bool update(const status & st);
+
+	/**
+	 * @brief Release slot of a service
+	 */
+	void remove(const std::string & name);
+
+	/**
+	 * @brief Names of services having a slot (daemon)
+	 */
+	void names(std::vector<std::string> & names) const;
+
+	/**
+	 * @brief Mark board as containing every service (or not)
+	 *
+	 * Readers can only tell that a service does not exist or list all
+	 * services if the board is complete.
+	 */
+	void set_complete(bool complete);
+
+	/** @brief True if board contains every service, false once abandoned */
+	bool complete() const;
+
+	/**
+	 * @brief True if a read gave up on a slot left half written
+	 *
+	 * Results of reads are not reliable, clients fall back to queries.
+	 */
+	inline bool abandoned() const;
+
+	/**
+	 * @brief Read status of a service
+	 * @return			false if service has no slot
+	 */
+	bool find(const std::string & name, status & st) const;
+
+	/**
+	 * @brief Read status of all services in slot (hash) order
+	 */
+	void read_all(std::vector<status> & statuses) const;
+
+	/** @brief max service name length stored in a slot */
+	static const size_t max_name_length = 63;
+
+	/** @brief initial slot count of a created board, power of two */
+	static const size_t default_capacity = 256;
+
+protected:
+	struct header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t slot_size;
+		/** slots in the file, power of two */
+		uint32_t capacity;
+		/** board contains every service */
+		uint32_t complete;
+		/** writer process, readers ignore the board if it is gone */
+		int32_t daemon_pid;
+		uint8_t reserved[40];
+	};
+
+	struct slot
+	{
+		/** seqlock sequence, odd while the slot is written */
+		uint32_t seq;
+		int32_t pid;
+		int32_t state;
+		int32_t respawn_count;
+		int32_t exit_code;
+		/** slot has been used, probing stops at a never used slot */
+		uint32_t used;
+		int64_t start_time;
+		/** NUL terminated, empty if slot is free */
+		char name[max_name_length + 1];
+		uint8_t padding[32];
+	};
+
+	/** @brief Slot count available in the mapping */
+	size_t slot_count() const;
+
+	/** @brief 32-bit FNV-1a hash of a service name */
+	static uint32_t hash(const std::string & name);
+
+	inline slot * slot_at(size_t index) const;
+
+	/**
+	 * @brief Copy a slot consistently (seqlock read side)
+	 *
+	 * Gives up and marks the board abandoned if the slot is still being
+	 * written after read_retries tries, or earlier if the daemon is gone.
+	 *
+	 * @return			false if slot is free or board is abandoned
+	 */
+	bool read_slot(const slot * s, status & st) const;
+
+	/** @brief Check whether the daemon writing the board is alive */
+	bool writer_alive() const;
+
+	/** @brief Begin writing a slot (seqlock write side) */
+	static void begin_write(slot * s);
+	/** @brief End writing a slot */
+	static void end_write(slot * s);
+
+	/**
+	 * @brief Map size bytes of the file
+	 * @param prot		PROT_READ, or PROT_READ | PROT_WRITE
+	 */
+	bool map_file(size_t size, int prot);
+
+	/** @brief Replace board with one of double slot count (daemon) */
+	bool grow();
+
+	static const uint32_t board_magic = 0x53425244; // "SBRD"
+	static const uint32_t board_version = 1;
+
+	/** @brief max tries to read a slot consistently */
+	static const unsigned int read_retries = 1 << 20;
+	/** @brief tries between checks of the daemon while reading a slot */
+	static const unsigned int read_check_interval = 1024;
+
+	std::string path;
+	int fd;
+	void * base;
+	size_t size;
+
+	/** @brief slot index by service name (daemon) */
+	std::map<std::string, size_t> slots;
+	/** @brief slots ever used, released slots included (daemon) */
+	size_t used;
+	/** @brief a read gave up on a half written slot (client) */
+	mutable bool stale;
+};
+
+inline bool status_board::is_open() const
+{
+	return base != NULL;
+}
+
+inline bool status_board::abandoned() const
+{
+	return stale;
+}
+
+inline status_board::slot * status_board::slot_at(size_t index) const
+{
+	return (slot *) ((char *) base + sizeof(header)) + index;
+}
+
+#endif /* STATUS_BOARD_H_ */
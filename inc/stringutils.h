@@ -15,6 +15,9 @@ void split(const std::string& str, const std::string& delim,
 
 void splitLine(const std::string& str, std::vector<std::string>& parts);
 
+std::string join(const std::vector<std::string>& parts,
+		const std::string& delim);
+
 template<typename T>
 static std::string to_string(T t)
 {
@@ -0,0 +1,167 @@
+#include "ipc/AsyncClient.h"
+
+#include "Debug.h"
+#include "Timer.h"
+
+using namespace std;
+
+/** @brief Time left of a timeout started at start, LLONG_MAX if unlimited */
+static long long remaining(const long long milliseconds, const uint64_t start)
+{
+	if (milliseconds == LLONG_MAX)
+		return LLONG_MAX;
+
+	long long left = milliseconds
+			- (long long) (Timer::getCurrentClock() - start);
+
+	return left < 0 ? 0 : left;
+}
+
+AsyncClient::AsyncClient(const std::string & server_path) :
+		DomainClient(), server_path(server_path)
+{
+}
+
+AsyncClient::~AsyncClient()
+{
+}
+
+uint32_t AsyncClient::submit(const Bundle & request, Callback callback,
+		void * context)
+{
+	// 0 means untagged, ids in flight are skipped after wrap around
+	do
+	{
+		++last_request_id;
+	} while (last_request_id == 0
+			|| requests.find(last_request_id) != requests.end());
+
+	uint32_t id = last_request_id;
+
+	if (!sendto(reply_address(server_path, id), request))
+		return 0;
+
+	Request & r = requests[id];
+	r.callback = callback;
+	r.context = context;
+
+	return id;
+}
+
+bool AsyncClient::wait(const uint32_t request_id, Bundle & reply,
+		const long long milliseconds, const bool last)
+{
+	uint64_t start = Timer::getCurrentClock();
+
+	while (true)
+	{
+		map<uint32_t, Request>::iterator it = requests.find(request_id);
+		if (it == requests.end() || it->second.callback != NULL)
+			return false;
+
+		Request & r = it->second;
+
+		if (!r.replies.empty())
+		{
+			bool ok = reply.importData((const unsigned char *) r.replies.front().data(),
+					r.replies.front().size());
+			r.replies.pop_front();
+
+			if (last)
+				requests.erase(it);
+
+			return ok;
+		}
+
+		long long left = remaining(milliseconds, start);
+		if (left == 0 || !route(left))
+			return false;
+	}
+}
+
+int AsyncClient::dispatch(const long long milliseconds)
+{
+	int n = 0;
+
+	// wait for the first reply only, then take what is available
+	if (!route(milliseconds))
+		return 0;
+
+	for (++n; route(0); ++n)
+		;
+
+	return n;
+}
+
+bool AsyncClient::drain(const long long milliseconds)
+{
+	uint64_t start = Timer::getCurrentClock();
+
+	while (callbacks() > 0)
+	{
+		long long left = remaining(milliseconds, start);
+		if (left == 0 || !route(left))
+			return false;
+	}
+
+	return true;
+}
+
+void AsyncClient::cancel(const uint32_t request_id)
+{
+	requests.erase(request_id);
+}
+
+bool AsyncClient::route(const long long milliseconds)
+{
+	string src, data, peer;
+
+	if (!receive(src, data, milliseconds))
+		return false;
+
+	uint32_t id = split_address(src, peer);
+
+	map<uint32_t, Request>::iterator it = requests.find(id);
+	if (peer != server_path || it == requests.end())
+	{
+		DD("dropped reply of unknown request %s\n", src.c_str());
+		return true;
+	}
+
+	Request & r = it->second;
+
+	if (r.callback == NULL)
+	{
+		r.replies.push_back(string());
+		r.replies.back().swap(data);
+		return true;
+	}
+
+	Bundle reply;
+	bool more = false;
+
+	if (reply.importData((const unsigned char *) data.data(), data.size()))
+		more = r.callback(id, reply, r.context);
+	else
+		DD("invalid reply of request %u\n", id);
+
+	// callback may cancel the request
+	if (!more)
+		requests.erase(id);
+
+	return true;
+}
+
+size_t AsyncClient::callbacks() const
+{
+	size_t n = 0;
+
+	for (map<uint32_t, Request>::const_iterator it = requests.begin();
+			it != requests.end(); ++it)
+	{
+		if (it->second.callback != NULL)
+			++n;
+	}
+
+	return n;
+}
@@ -7,6 +7,7 @@
 
 #include "serializer/Bundle.h"
 
+#include <cstring>
 #include <stdexcept>
 #include <iostream>
 #include <sstream>
@@ -15,12 +16,16 @@ using namespace std;
 
 #include "serializer/Serializable.h"
 
+/** @brief Version byte in front of exported data, region of exportRegions() */
+static unsigned char format_v2 = Bundle::FORMAT_V2;
+
 Bundle::Bundle() :
-		wind(0), rind(0)
+		wind(0), rind(0), elements(0)
 {
 }
 
-Bundle::Bundle(const unsigned char* buf, const int size)
+Bundle::Bundle(const unsigned char* buf, const int size) :
+		wind(0), rind(0), elements(0)
 {
 	if (!importData(buf, size))
 		throw std::invalid_argument(
@@ -28,9 +33,33 @@ Bundle::Bundle(const unsigned char* buf, const int size)
 }
 
 Bundle::Bundle(const Bundle & bundle) :
-		buf(bundle.buf), wind(bundle.wind), rind(bundle.rind)
+		wind(bundle.wind - bundle.rind), rind(0), elements(bundle.elements)
+{
+	// unread elements only
+	buf.assign((const unsigned char *) bundle.buf + bundle.rind, wind);
+}
+
+#if __cplusplus >= 201103L
+Bundle::Bundle(Bundle && bundle) :
+		wind(bundle.wind), rind(bundle.rind), elements(bundle.elements)
+{
+	buf.swap(bundle.buf);
+
+	bundle.wind = 0;
+	bundle.rind = 0;
+	bundle.elements = 0;
+}
+
+Bundle & Bundle::operator =(Bundle && bundle)
 {
+	buf.swap(bundle.buf);
+	std::swap(wind, bundle.wind);
+	std::swap(rind, bundle.rind);
+	std::swap(elements, bundle.elements);
+
+	return *this;
 }
+#endif
 
 Bundle::~Bundle()
 {
@@ -39,67 +68,113 @@ Bundle::~Bundle()
 
 const Bundle & Bundle::operator =(const Bundle & bundle)
 {
-	this->buf = bundle.buf;
-	this->wind = bundle.wind;
-	this->rind = bundle.rind;
+	if (this == &bundle)
+		return *this;
+
+	// unread elements only
+	this->wind = bundle.wind - bundle.rind;
+	this->rind = 0;
+	this->elements = bundle.elements;
+	this->buf.assign((const unsigned char *) bundle.buf + bundle.rind,
+			this->wind);
 
 	return *this;
 }
 
 void Bundle::putInt(const int& i)
 {
-	buf[wind++] = TYPE_INT;
-
-	buf[wind++] = 0x00;
-	buf[wind++] = 0x01;
+	putHeader(TYPE_INT, 1);
 
 	Bundle::put(i);
 }
 
 void Bundle::putChar(const char& c)
 {
-	buf[wind++] = TYPE_CHAR;
-
-	buf[wind++] = 0x00;
-	buf[wind++] = 0x01;
+	putHeader(TYPE_CHAR, 1);
 
 	Bundle::put(c);
 }
 
 void Bundle::putBool(const bool& b)
 {
-	buf[wind++] = TYPE_BOOL;
-
-	buf[wind++] = 0x00;
-	buf[wind++] = 0x01;
+	putHeader(TYPE_BOOL, 1);
 
 	Bundle::put(b);
 }
 
 void Bundle::putDouble(const double& d)
 {
-	buf[wind++] = TYPE_DOUBLE;
-
-	buf[wind++] = 0x00;
-	buf[wind++] = 0x01;
+	putHeader(TYPE_DOUBLE, 1);
 
 	Bundle::put(d);
 }
 
 void Bundle::putString(const string& s)
 {
-	buf[wind++] = TYPE_STRING;
-
-	buf[wind++] = 0x00;
-	buf[wind++] = 0x01;
+	putHeader(TYPE_STRING, 1);
 
 	Bundle::put(s);
 }
 
+void Bundle::putInt64(const int64_t& i)
+{
+	putHeader(TYPE_INT64, 1);
+
+	Bundle::put(i);
+}
+
+void Bundle::putUInt64(const uint64_t& i)
+{
+	putHeader(TYPE_UINT64, 1);
+
+	Bundle::put(i);
+}
+
+void Bundle::putBlob(const void * data, const int size)
+{
+	putHeader(TYPE_BLOB, 1);
+	putVarint(size);
+
+	buf.reserve(wind + size);
+	::memcpy((unsigned char *) buf + wind, data, size);
+	wind += size;
+}
+
 void Bundle::putBundle(const Bundle& b)
 {
-	for (int i = 0; i < b.wind; ++i)
-		buf[wind++] = b.buf[i];
+	int size = b.wind - b.rind;
+
+	// unread elements only
+	buf.reserve(wind + size);
+	::memcpy((unsigned char *) buf + wind, (const unsigned char *) b.buf + b.rind,
+			size);
+	wind += size;
+	elements += b.elements;
+}
+
+void Bundle::putArray(const vector<bool>& vec)
+{
+	putHeader(TYPE_BOOL, vec.size());
+
+	// vector<bool> is not contiguous, walk it once
+	int bytes = (vec.size() + 7) / 8;
+
+	buf.reserve(wind + bytes);
+	unsigned char * p = (unsigned char *) buf + wind;
+
+	vector<bool>::const_iterator it = vec.begin();
+	for (int n = 0; n < bytes; ++n)
+	{
+		unsigned char byte = 0;
+
+		for (int bit = 0; bit < 8 && it != vec.end(); ++bit, ++it)
+			if (*it)
+				byte |= 1 << bit;
+
+		p[n] = byte;
+	}
+
+	wind += bytes;
 }
 
 void Bundle::putSerializable(const Serializable & s)
@@ -107,10 +182,16 @@ void Bundle::putSerializable(const Serializable & s)
 	s.writeToBundle(*this);
 }
 
+void Bundle::reserve(const int size)
+{
+	buf.reserve(wind + size);
+}
+
 void Bundle::clear()
 {
 	wind = 0;
 	rind = 0;
+	elements = 0;
 	buf.resize();
 }
 
@@ -159,11 +240,80 @@ string Bundle::getString()
 	return s;
 }
 
+int64_t Bundle::getInt64()
+{
+	int64_t i;
+
+	get(i);
+
+	return i;
+}
+
+uint64_t Bundle::getUInt64()
+{
+	uint64_t i;
+
+	get(i);
+
+	return i;
+}
+
+void Bundle::getBlob(vector<unsigned char> & blob)
+{
+	unsigned int count, length;
+
+	int i = header(TYPE_BLOB, count);
+
+	if (count != 1)
+		throw std::runtime_error(
+				string(__PRETTY_FUNCTION__) + " Invalid operation");
+
+	readVarint((const unsigned char *) buf, wind, i, length);
+
+	blob.assign((const unsigned char *) buf + i,
+			(const unsigned char *) buf + i + length);
+
+	consumed(i + length);
+}
+
 void Bundle::getSerializable(Serializable& s)
 {
 	s.readFromBundle(*this);
 }
 
+void Bundle::getBundle(Bundle& b, const int count)
+{
+	if (count < 0 || count > elements)
+		throw std::runtime_error(
+				string(__PRETTY_FUNCTION__) + " Invalid operation");
+
+	int end = rind;
+
+	// skip elements
+	for (int n = 0; n < count; ++n)
+	{
+		end = skipElement((const unsigned char *) buf, wind, end);
+
+		if (end < 0)
+			throw std::runtime_error(
+					string(__PRETTY_FUNCTION__) + " Invalid operation");
+	}
+
+	b.buf.reserve(b.wind + end - rind);
+	::memcpy((unsigned char *) b.buf + b.wind, (unsigned char *) buf + rind,
+			end - rind);
+	b.wind += end - rind;
+	b.elements += count;
+	rind = end;
+	elements -= count;
+
+	// reset indices
+	if (wind == rind)
+		wind = rind = 0;
+
+	rearrange();
+}
+
 /* Stream Insertion Operators */
 
 Bundle& Bundle::operator <<(const int& i)
@@ -196,6 +346,18 @@ Bundle& Bundle::operator <<(const string& i)
 	return *this;
 }
 
+Bundle& Bundle::operator <<(const int64_t& i)
+{
+	putInt64(i);
+	return *this;
+}
+
+Bundle& Bundle::operator <<(const uint64_t& i)
+{
+	putUInt64(i);
+	return *this;
+}
+
 Bundle & Bundle::operator <<(const char * i)
 {
 	putString(i);
@@ -246,106 +408,270 @@ Bundle& Bundle::operator >>(string& i)
 	return *this;
 }
 
+Bundle& Bundle::operator >>(int64_t& i)
+{
+	i = getInt64();
+	return *this;
+}
+
+Bundle& Bundle::operator >>(uint64_t& i)
+{
+	i = getUInt64();
+	return *this;
+}
+
 Bundle& Bundle::operator >>(Serializable& s)
 {
 	getSerializable(s);
 	return *this;
 }
 
-int Bundle::getArray(string *& arr)
+int Bundle::getArray(bool *& arr)
 {
-	unsigned char type = buf[rind++];
+	unsigned int count;
 
-	if (type != TYPE_STRING)
-		throw std::invalid_argument(
-				string(__func__) + " Invalid argument type");
+	int i = header(TYPE_BOOL, count);
 
-	uint count, length;
+	arr = new bool[count];
 
-	count = (buf[rind] << 8) | buf[rind + 1];
-	rind += 2;
+	const unsigned char * p = (const unsigned char *) buf + i;
+	for (unsigned int n = 0; n < count; ++n)
+		arr[n] = (p[n >> 3] >> (n & 0x07)) & 0x01;
 
-	arr = new string[count];
+	consumed(i + (count + 7) / 8);
 
-	for (uint i = 0; i < count; ++i)
-	{
-		length = (buf[rind] << 8) | buf[rind + 1];
-		rind += 2;
+	return count;
+}
 
-		arr[i].resize(length);
+void Bundle::getArray(vector<bool>& vec)
+{
+	unsigned int count;
 
-		for (size_t j = 0; j < length; ++j)
-			arr[i][j] = buf[rind++];
+	int i = header(TYPE_BOOL, count);
 
-//		cerr << "arr[" << i << "] : " << vec[i] << endl;
+	vec.resize(count);
+
+	const unsigned char * p = (const unsigned char *) buf + i;
+
+	vector<bool>::iterator it = vec.begin();
+	for (unsigned int n = 0; n < count; ++n, ++it)
+		*it = (p[n >> 3] >> (n & 0x07)) & 0x01;
+
+	consumed(i + (count + 7) / 8);
+}
+
+int Bundle::getArray(string *& arr)
+{
+	unsigned int count, length;
+
+	int i = header(TYPE_STRING, count);
+
+	arr = new string[count];
+
+	for (unsigned int n = 0; n < count; ++n)
+	{
+		readVarint((const unsigned char *) buf, wind, i, length);
+
+		arr[n].assign((const char *) (unsigned char *) buf + i, length);
+		i += length;
 	}
 
-	// reset indices
-	if (wind == rind)
-		wind = rind = 0;
+	consumed(i);
 
 	return count;
 }
 
 void Bundle::getArray(vector<string>& vec)
 {
-	unsigned char type = buf[rind];
-	if (type != TYPE_STRING)
-		throw std::invalid_argument("Invalid argument type");
-
-	++rind;
-
-	uint count, length;
+	unsigned int count, length;
 
-	count = (buf[rind] << 8) | buf[rind + 1];
-	rind += 2;
+	int i = header(TYPE_STRING, count);
 
 	vec.resize(count);
 
-	for (uint i = 0; i < count; ++i)
+	for (unsigned int n = 0; n < count; ++n)
 	{
-		length = (buf[rind] << 8) | buf[rind + 1];
-		rind += 2;
-
-		vec[i].resize(length);
-
-		for (size_t j = 0; j < length; ++j)
-			vec[i][j] = buf[rind++];
+		readVarint((const unsigned char *) buf, wind, i, length);
 
-//		cerr << "arr[" << i << "] : " << vec[i] << endl;
+		vec[n].assign((const char *) (unsigned char *) buf + i, length);
+		i += length;
 	}
 
-	// reset indices
-	if (wind == rind)
-		wind = rind = 0;
+	consumed(i);
 }
 
 bool Bundle::importData(const unsigned char* buf, const int size)
 {
-	if (Bundle::checkValidity(buf, size) < 0)
+	// old peers send format v1 without version byte
+	if (size == 0 || buf[0] != FORMAT_V2)
+		return importV1(buf, size);
+
+	int count = Bundle::checkValidity(buf + 1, size - 1);
+	if (count < 0)
 		return false;
 
 	rind = 0;
-	wind = size;
+	wind = size - 1;
+	elements = count;
+
+	this->buf.assign(buf + 1, size - 1);
+
+	return true;
+}
+
+bool Bundle::importV1(const unsigned char * buf, const int size)
+{
+	int count = Bundle::checkValidityV1(buf, size);
+	if (count < 0)
+		return false;
 
-	this->buf.resize(size);
+	clear();
+	this->buf.reserve(size);
+
+	int i = 0;
+	while (i < size)
+	{
+		unsigned char type = buf[i];
+		unsigned int items = (buf[i + 1] << 8) | buf[i + 2];
+		i += 3;
 
-	for (int i = 0; i < size; ++i)
-		this->buf[i] = buf[i];
+		putHeader(type, items);
+
+		// bools are packed
+		if (type == TYPE_BOOL)
+		{
+			int bytes = (items + 7) / 8;
+
+			this->buf.reserve(wind + bytes);
+			unsigned char * p = (unsigned char *) this->buf + wind;
+			::memset(p, 0, bytes);
+
+			for (unsigned int n = 0; n < items; ++n, i += 3)
+			{
+				if (buf[i] != 0 || buf[i + 1] != 1)
+				{
+					clear();
+					return false;
+				}
+
+				if (buf[i + 2])
+					p[n >> 3] |= 1 << (n & 0x07);
+			}
+
+			wind += bytes;
+			continue;
+		}
+
+		int width = typeWidth(type);
+
+		for (unsigned int n = 0; n < items; ++n)
+		{
+			int length = (buf[i] << 8) | buf[i + 1];
+			i += 2;
+
+			// e.g. float as double
+			if (width != 0 && length != width)
+			{
+				clear();
+				return false;
+			}
+
+			if (width == 0)
+				putVarint(length);
+
+			this->buf.reserve(wind + length);
+			::memcpy((unsigned char *) this->buf + wind, buf + i, length);
+			wind += length;
+			i += length;
+		}
+	}
 
 	return true;
 }
 
 int Bundle::exportData(unsigned char* buf, const int size) const
 {
-	if (size < wind - rind)
+	if (size < wind - rind + 1)
 		return -1;
 
-	int i = 0;
-	for (int j = rind; j < wind; ++i, ++j)
-		buf[i] = this->buf[j];
+	buf[0] = FORMAT_V2;
+	::memcpy(buf + 1, (const unsigned char *) this->buf + rind, wind - rind);
 
-	return i;
+	return wind - rind + 1;
+}
+
+bool Bundle::exportLegacy(string & data) const
+{
+	const unsigned char * p = (const unsigned char *) buf;
+	unsigned int count, length;
+
+	data.clear();
+	data.reserve(2 * (wind - rind));
+
+	int i = rind;
+	while (i < wind)
+	{
+		unsigned char type = p[i++];
+		readVarint(p, wind, i, count);
+
+		if (type > TYPE_STRING || count > 0xFFFF)
+			return false;
+
+		data += (char) type;
+		data += (char) (count >> 8);
+		data += (char) (count & 0xFF);
+
+		// bools are packed
+		if (type == TYPE_BOOL)
+		{
+			for (unsigned int n = 0; n < count; ++n)
+			{
+				data += (char) 0;
+				data += (char) 1;
+				data += (char) ((p[i + (n >> 3)] >> (n & 0x07)) & 0x01);
+			}
+
+			i += (count + 7) / 8;
+			continue;
+		}
+
+		int width = typeWidth(type);
+
+		for (unsigned int n = 0; n < count; ++n)
+		{
+			length = width;
+			if (width == 0)
+				readVarint(p, wind, i, length);
+
+			if (length > 0xFFFF)
+				return false;
+
+			data += (char) (length >> 8);
+			data += (char) (length & 0xFF);
+			data.append((const char *) p + i, length);
+			i += length;
+		}
+	}
+
+	return true;
+}
+
+int Bundle::exportRegions(struct iovec * iov, const int count) const
+{
+	if (count < 2)
+		return -1;
+
+	iov[0].iov_base = &format_v2;
+	iov[0].iov_len = 1;
+
+	if (wind == rind)
+		return 1;
+
+	// data is contiguous
+	iov[1].iov_base = (unsigned char *) buf + rind;
+	iov[1].iov_len = wind - rind;
+
+	return 2;
 }
 
 void Bundle::print() const
@@ -396,6 +722,9 @@ string Bundle::toString() const
 	vector<double> vdouble;
 	vector<int> vint;
 	vector<string> vstring;
+	vector<int64_t> vint64;
+	vector<uint64_t> vuint64;
+	vector<unsigned char> blob;
 	stringstream s_str;
 
 	int count = b.count();
@@ -433,6 +762,21 @@ string Bundle::toString() const
 			s_str << vstring;
 			break;
 
+		case Bundle::TYPE_INT64:
+			b.getArray(vint64);
+			s_str << vint64;
+			break;
+
+		case Bundle::TYPE_UINT64:
+			b.getArray(vuint64);
+			s_str << vuint64;
+			break;
+
+		case Bundle::TYPE_BLOB:
+			b.getBlob(blob);
+			s_str << "<" << blob.size() << " bytes>" << endl;
+			break;
+
 		case Bundle::TYPE_UNDEF:
 //			cerr << "\tUNDEFINED RESPONSE" << endl;
 			break;
@@ -446,26 +790,11 @@ string Bundle::toString() const
 	return s_str.str();
 }
 
-int Bundle::count() const
-{
-	int _count = checkValidity(((const unsigned char *) this->buf) + rind,
-			wind - rind);
-	return _count;
-}
-
 int Bundle::byteCount() const
 {
 	return wind - rind;
 }
 
-unsigned char Bundle::getNextType() const
-{
-	if (count() <= 0)
-		return TYPE_UNDEF;
-
-	return buf[rind];
-}
-
 unsigned char Bundle::getType(const std::type_info & ti)
 {
 	if (ti == typeid(int) || ti == typeid(unsigned int))
@@ -483,13 +812,84 @@ unsigned char Bundle::getType(const std::type_info & ti)
 	if (ti == typeid(string))
 		return TYPE_STRING;
 
+	if (ti == typeid(int64_t) || ti == typeid(long long))
+		return TYPE_INT64;
+
+	if (ti == typeid(uint64_t) || ti == typeid(unsigned long long))
+		return TYPE_UINT64;
+
 	return 0;
 }
 
+int Bundle::skipElement(const unsigned char * buf, const int size, int i)
+{
+	unsigned int count, length;
+
+	if (i >= size)
+		return -1;
+
+	// type
+	unsigned char type = buf[i++];
+	if (type == 0 || type >= TYPE_UNDEF)
+		return -1;
+
+	// count
+	if (!readVarint(buf, size, i, count))
+		return -1;
+
+	// bits of bools
+	if (type == TYPE_BOOL)
+	{
+		if ((count + 7) / 8 > (unsigned int) (size - i))
+			return -1;
+
+		return i + (count + 7) / 8;
+	}
+
+	// data of fixed width elements
+	int width = typeWidth(type);
+	if (width > 0)
+	{
+		if (count > (unsigned int) (size - i) / width)
+			return -1;
+
+		return i + count * width;
+	}
+
+	// length + data
+	for (unsigned int j = 0; j < count; ++j)
+	{
+		if (!readVarint(buf, size, i, length)
+				|| length > (unsigned int) (size - i))
+			return -1;
+
+		i += length;
+	}
+
+	return i;
+}
+
 int Bundle::checkValidity(const unsigned char * buf, const int size)
 {
 	int elementCount = 0;
 
+	int i = 0;
+	while (i < size)
+	{
+		i = skipElement(buf, size, i);
+		if (i < 0)
+			return -1;
+
+		++elementCount;
+	}
+
+	return elementCount;
+}
+
+int Bundle::checkValidityV1(const unsigned char * buf, const int size)
+{
+	int elementCount = 0;
+
 	int i = 0;
 	unsigned char type;
 	uint count, length;
@@ -498,7 +898,7 @@ int Bundle::checkValidity(const unsigned char * buf, const int size)
 	{
 		// type
 		type = buf[i++];
-		if (type == 0 || type >= TYPE_UNDEF)
+		if (type == 0 || type > TYPE_STRING)
 		{
 			elementCount = -1;
 //			cerr << __PRETTY_FUNCTION__ << " TYPE UNDEFINED  " << i << endl;
@@ -506,12 +906,18 @@ int Bundle::checkValidity(const unsigned char * buf, const int size)
 		}
 
 		// count
+		if (i + 2 > size)
+			return -2;
+
 		count = (buf[i] << 8) | buf[i + 1];
 		i += 2;
 
 		// length + data
 		for (uint j = 0; j < count; ++j)
 		{
+			if (i + 2 > size)
+				return -2;
+
 			length = (buf[i] << 8) | buf[i + 1];
 			i += 2;
 
@@ -519,9 +925,8 @@ int Bundle::checkValidity(const unsigned char * buf, const int size)
 
 			if (i > size)
 			{
-				elementCount = -2;
 //				cerr << __PRETTY_FUNCTION__ << " LENGTH + DATA       " << i << " >= " << size << endl;
-				break;
+				return -2;
 			}
 		} // end-of-for
 
@@ -532,35 +937,100 @@ int Bundle::checkValidity(const unsigned char * buf, const int size)
 	return elementCount;
 }
 
+void Bundle::putVarint(unsigned int value)
+{
+	buf.reserve(wind + 5);
+
+	unsigned char * p = (unsigned char *) buf;
+
+	while (value >= 0x80)
+	{
+		p[wind++] = (value & 0x7F) | 0x80;
+		value >>= 7;
+	}
+
+	p[wind++] = value;
+}
+
+void Bundle::putElements(const bool * arr, const int count)
+{
+	int bytes = (count + 7) / 8;
+
+	buf.reserve(wind + bytes);
+	unsigned char * p = (unsigned char *) buf + wind;
+	::memset(p, 0, bytes);
+
+	for (int n = 0; n < count; ++n)
+		if (arr[n])
+			p[n >> 3] |= 1 << (n & 0x07);
+
+	wind += bytes;
+}
+
+void Bundle::putElements(const string * arr, const int count)
+{
+	for (int n = 0; n < count; ++n)
+		put(arr[n]);
+}
+
+void Bundle::putHeader(const unsigned char type, const unsigned int count)
+{
+	buf[wind++] = type;
+	putVarint(count);
+
+	++elements;
+}
+
 void Bundle::put(const string & s)
 {
-	buf[wind++] = (s.length() >> 8) & 0xFF;
-	buf[wind++] = s.length() & 0xFF;
+	putVarint(s.length());
+
+	buf.reserve(wind + s.length());
 
 	// data
-	for (size_t i = 0; i < s.length(); ++i)
-		buf[wind++] = s[i];
+	::memcpy((unsigned char *) buf + wind, s.data(), s.length());
+	wind += s.length();
 }
 
 void Bundle::get(string & s)
 {
-	unsigned char type = buf[rind++];
-	uint count, length;
-
-	count = (buf[rind] << 8) | buf[rind + 1];
-	rind += 2;
+	unsigned int count, length;
 
-	length = (buf[rind] << 8) | buf[rind + 1];
-	rind += 2;
+	int i = header(TYPE_STRING, count);
 
-	if (type != TYPE_STRING || count != 1)
+	if (count != 1)
 		throw std::runtime_error(
 				string(__PRETTY_FUNCTION__) + " Invalid operation");
 
-	s.resize(length);
+	readVarint((const unsigned char *) buf, wind, i, length);
+
+	s.assign((const char *) (unsigned char *) buf + i, length);
+
+	consumed(i + length);
+}
+
+int Bundle::header(const unsigned char type, unsigned int & count) const
+{
+	if (elements <= 0)
+		throw std::runtime_error(
+				string(__PRETTY_FUNCTION__) + " no element left");
+
+	const unsigned char * p = (const unsigned char *) buf;
+
+	if (p[rind] != type)
+		throw std::runtime_error("invalid operation");
+
+	// validated by importData() or written by put functions
+	int i = rind + 1;
+	readVarint(p, wind, i, count);
 
-	for (uint i = 0; i < length; ++i)
-		s[i] = buf[rind++];
+	return i;
+}
+
+void Bundle::consumed(const int end)
+{
+	rind = end;
+	--elements;
 
 	// reset indices
 	if (wind == rind)
@@ -571,13 +1041,13 @@ void Bundle::get(string & s)
 
 void Bundle::rearrange()
 {
-	if (rind < 256)
+	// move once read part outweighs the rest, amortized constant cost
+	if (rind < 256 || rind < wind - rind)
 		return;
 
 //	DD("arranging... : %d   %d\n", rind, wind);
 
-	for (int i = rind, j = 0; i < wind; ++i, ++j)
-		buf[j] = buf[i];
+	::memmove((unsigned char *) buf, (unsigned char *) buf + rind, wind - rind);
 
 	wind -= rind;
 	rind = 0;
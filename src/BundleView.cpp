@@ -0,0 +1,314 @@
+#include "serializer/BundleView.h"
+
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+BundleView::BundleView() :
+		buf(NULL), size(0), rind(0), elements(0)
+{
+}
+
+BundleView::BundleView(const unsigned char * buf, const int size) :
+		buf(NULL), size(0), rind(0), elements(0)
+{
+	if (!set(buf, size))
+		throw std::invalid_argument(
+				string(__PRETTY_FUNCTION__) + " : buf is in invalid format.");
+}
+
+BundleView::~BundleView()
+{
+}
+
+bool BundleView::set(const unsigned char * buf, const int size)
+{
+	// format v2 only, Bundle::importData() converts v1
+	int count = -1;
+	if (size > 0 && buf[0] == Bundle::FORMAT_V2)
+		count = Bundle::checkValidity(buf + 1, size - 1);
+
+	if (count < 0)
+	{
+		clear();
+		return false;
+	}
+
+	this->buf = buf + 1;
+	this->size = size - 1;
+	this->rind = 0;
+	this->elements = count;
+
+	return true;
+}
+
+void BundleView::clear()
+{
+	buf = NULL;
+	size = 0;
+	rind = 0;
+	elements = 0;
+}
+
+int BundleView::next(const unsigned char type)
+{
+	if (elements <= 0)
+		throw std::runtime_error(
+				string(__PRETTY_FUNCTION__) + " no element left");
+
+	if (buf[rind] != type)
+		throw std::runtime_error("invalid operation");
+
+	// [T] [C] ([L]) [D], validated by set()
+	int i = rind + 1;
+	unsigned int count;
+	Bundle::readVarint(buf, size, i, count);
+
+	if (count != 1)
+		throw std::runtime_error("invalid operation");
+
+	unsigned int length = Bundle::typeWidth(type);
+	if (length == 0)
+		Bundle::readVarint(buf, size, i, length);
+
+	rind = i;
+	--elements;
+
+	return length;
+}
+
+unsigned int BundleView::array(const unsigned char type)
+{
+	if (elements <= 0)
+		throw std::runtime_error(
+				string(__PRETTY_FUNCTION__) + " no element left");
+
+	if (buf[rind] != type)
+		throw std::runtime_error("invalid operation");
+
+	int i = rind + 1;
+	unsigned int count;
+	Bundle::readVarint(buf, size, i, count);
+
+	rind = i;
+	--elements;
+
+	return count;
+}
+
+int BundleView::skip(const int count) const
+{
+	if (count < 0 || count > elements)
+		throw std::runtime_error(
+				string(__PRETTY_FUNCTION__) + " Invalid operation");
+
+	int end = rind;
+
+	for (int n = 0; n < count; ++n)
+		end = Bundle::skipElement(buf, size, end);
+
+	return end;
+}
+
+int BundleView::getInt()
+{
+	int i;
+
+	if (next(Bundle::TYPE_INT) != sizeof(i))
+		throw std::runtime_error("invalid operation");
+
+	::memcpy(&i, buf + rind, sizeof(i));
+	rind += sizeof(i);
+
+	return i;
+}
+
+char BundleView::getChar()
+{
+	if (next(Bundle::TYPE_CHAR) != sizeof(char))
+		throw std::runtime_error("invalid operation");
+
+	return (char) buf[rind++];
+}
+
+bool BundleView::getBool()
+{
+	if (next(Bundle::TYPE_BOOL) != sizeof(bool))
+		throw std::runtime_error("invalid operation");
+
+	return buf[rind++] & 0x01;
+}
+
+double BundleView::getDouble()
+{
+	double d;
+
+	if (next(Bundle::TYPE_DOUBLE) != sizeof(d))
+		throw std::runtime_error("invalid operation");
+
+	::memcpy(&d, buf + rind, sizeof(d));
+	rind += sizeof(d);
+
+	return d;
+}
+
+string BundleView::getString()
+{
+	const char * data;
+	int length;
+
+	getString(data, length);
+
+	return string(data, length);
+}
+
+void BundleView::getString(const char *& data, int & length)
+{
+	length = next(Bundle::TYPE_STRING);
+	data = (const char *) buf + rind;
+	rind += length;
+}
+
+int64_t BundleView::getInt64()
+{
+	int64_t i;
+
+	if (next(Bundle::TYPE_INT64) != sizeof(i))
+		throw std::runtime_error("invalid operation");
+
+	::memcpy(&i, buf + rind, sizeof(i));
+	rind += sizeof(i);
+
+	return i;
+}
+
+uint64_t BundleView::getUInt64()
+{
+	uint64_t i;
+
+	if (next(Bundle::TYPE_UINT64) != sizeof(i))
+		throw std::runtime_error("invalid operation");
+
+	::memcpy(&i, buf + rind, sizeof(i));
+	rind += sizeof(i);
+
+	return i;
+}
+
+void BundleView::getBlob(const unsigned char *& data, int & size)
+{
+	size = next(Bundle::TYPE_BLOB);
+	data = buf + rind;
+	rind += size;
+}
+
+void BundleView::getArray(vector<bool> & vec)
+{
+	unsigned int count = array(Bundle::TYPE_BOOL);
+
+	vec.resize(count);
+
+	for (unsigned int n = 0; n < count; ++n)
+		vec[n] = (buf[rind + (n >> 3)] >> (n & 0x07)) & 0x01;
+
+	rind += (count + 7) / 8;
+}
+
+void BundleView::getArray(vector<string> & vec)
+{
+	unsigned int count = array(Bundle::TYPE_STRING);
+	unsigned int length;
+
+	vec.resize(count);
+
+	for (unsigned int n = 0; n < count; ++n)
+	{
+		Bundle::readVarint(buf, size, rind, length);
+
+		vec[n].assign((const char *) buf + rind, length);
+		rind += length;
+	}
+}
+
+void BundleView::getArray(const char *& data, int & count)
+{
+	count = array(Bundle::TYPE_CHAR);
+	data = (const char *) buf + rind;
+	rind += count;
+}
+
+void BundleView::getView(BundleView & view, const int count)
+{
+	int end = skip(count);
+
+	view.buf = buf + rind;
+	view.size = end - rind;
+	view.rind = 0;
+	view.elements = count;
+
+	rind = end;
+	elements -= count;
+}
+
+/* Stream Extraction Operators */
+
+BundleView & BundleView::operator >>(int & i)
+{
+	i = getInt();
+	return *this;
+}
+
+BundleView & BundleView::operator >>(char & i)
+{
+	i = getChar();
+	return *this;
+}
+
+BundleView & BundleView::operator >>(bool & i)
+{
+	i = getBool();
+	return *this;
+}
+
+BundleView & BundleView::operator >>(double & i)
+{
+	i = getDouble();
+	return *this;
+}
+
+BundleView & BundleView::operator >>(string & i)
+{
+	i = getString();
+	return *this;
+}
+
+BundleView & BundleView::operator >>(int64_t & i)
+{
+	i = getInt64();
+	return *this;
+}
+
+BundleView & BundleView::operator >>(uint64_t & i)
+{
+	i = getUInt64();
+	return *this;
+}
+
+void BundleView::toBundle(Bundle & bundle) const
+{
+	bundle.clear();
+
+	// already validated, copied as is
+	bundle.buf.assign(buf + rind, size - rind);
+	bundle.wind = size - rind;
+	bundle.elements = elements;
+}
+
+string BundleView::toString() const
+{
+	Bundle b;
+	toBundle(b);
+
+	return b.toString();
+}
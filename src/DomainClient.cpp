@@ -37,7 +37,15 @@ bool DomainClient::open(void)
 	sprintf((char *) tmpBuf, "%s__%06u_%06lu_%06u", __progname, getpid(),
 			pthread_self(), DomainClient::obj_id);
 
-	return DomainServer::open((char *) tmpBuf);
+	close();
+
+	// bound address identifies this client to the server
+	b_open = DomainServer::bind((char *) tmpBuf, 0);
+
+	if (!b_open)
+		close();
+
+	return b_open;
 }
 
 bool DomainClient::open(const string & path)
@@ -1,24 +1,40 @@
 #include "ipc/DomainServer.h"
 
-#include <cstring>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <cerrno>
 #include <iostream>
+#include <vector>
 
 #include <fcntl.h>
-#include <sys/ioctl.h>
-#include <sys/select.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <unistd.h>
 
 #include "Debug.h"
 #include "Timer.h"
 
+/** @brief max events handled per epoll_wait() call */
+#define DOMAINSERVER_MAX_EVENTS			32
+
 using namespace std;
 
+/** @brief Fill abstract socket address of given path */
+static void make_address(struct sockaddr_un & address, const string & path)
+{
+	::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+
+	// copy path
+	::strncpy(address.sun_path + 1, path.c_str(), sizeof(address.sun_path) - 2);
+	// make path abstract
+	address.sun_path[0] = 0;
+}
+
 DomainServer::DomainServer(const string & path) :
-		socket_path(path), socket_fd(-1), address_length(
-				sizeof(struct sockaddr_un)), b_open(false)
+		socket_path(path), socket_fd(-1), epoll_fd(-1), listening(false), b_open(
+				false), anonymous_peers(0), last_request_id(0)
 {
 	if (!path.empty())
 		open(path);
@@ -31,42 +47,114 @@ DomainServer::~DomainServer()
 
 bool DomainServer::open(const string & path)
 {
-	b_open = true;
+	close();
+
+	b_open = listen(path);
+
+	if (!b_open)
+		close();
+
+	return b_open;
+}
 
+bool DomainServer::bind(const string & path, const int flags)
+{
 	socket_path = path;
 
-	socket_fd = ::socket(AF_UNIX, SOCK_DGRAM, 0);
+	socket_fd = ::socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC | flags, 0);
 	if (socket_fd < 0)
 	{
 		DD("socket() failed: %s\n", strerror(errno));
-		b_open = false;
+		return false;
 	}
-	else
+
+	struct sockaddr_un address;
+	make_address(address, path);
+
+	if (::bind(socket_fd, (const struct sockaddr *) &address,
+			sizeof(struct sockaddr_un)) < 0)
 	{
-		// fill server address
+		DD("bind() failed: %s\n", strerror(errno));
+		return false;
+	}
 
-		::memset(&server_address, 0, sizeof(server_address));
-		server_address.sun_family = AF_UNIX;
+	return true;
+}
 
-		// copy path
-		::strcpy(server_address.sun_path + 1, path.c_str());
-		// make path abstract
-		server_address.sun_path[0] = 0;
+bool DomainServer::listen(const string & path)
+{
+	if (!bind(path, SOCK_NONBLOCK))
+		return false;
 
-		if (::bind(socket_fd, (const struct sockaddr *) &server_address,
-				sizeof(struct sockaddr_un)) < 0)
-		{
-			DD("bind() failed: %s\n", strerror(errno));
-			b_open = false;
-		}
+	if (::listen(socket_fd, SOMAXCONN) < 0)
+	{
+		DD("listen() failed: %s\n", strerror(errno));
+		return false;
 	}
 
-	// fill client address
+	epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+	{
+		DD("epoll_create1() failed: %s\n", strerror(errno));
+		return false;
+	}
 
-	::memset(&client_address, 0, sizeof(client_address));
-	client_address.sun_family = AF_UNIX;
+	struct epoll_event ev;
+	::memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = socket_fd;
 
-	return b_open;
+	if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket_fd, &ev) < 0)
+	{
+		DD("epoll_ctl(ADD) failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	listening = true;
+
+	// packet buffers are reused by every read
+	ring.resize(BATCH_SIZE * PACKET_SIZE);
+
+	return true;
+}
+
+bool DomainServer::connect(const string & dst_path)
+{
+	map<string, int>::const_iterator it = peers.find(dst_path);
+	if (it != peers.end())
+		return true;
+
+	// connected to another server, a socket connects only once
+	if (!connections.empty())
+		close_connection(socket_fd);
+
+	// socket is closed with its connection
+	if (socket_fd < 0 && !bind(socket_path, 0))
+		return false;
+
+	struct sockaddr_un address;
+	make_address(address, dst_path);
+
+	if (::connect(socket_fd, (const struct sockaddr *) &address,
+			sizeof(struct sockaddr_un)) < 0)
+	{
+		DD("connect(%s) failed: %s\n", dst_path.c_str(), strerror(errno));
+		return false;
+	}
+
+	Connection & c = connections[socket_fd];
+	c.fd = socket_fd;
+	c.peer = dst_path;
+	c.in_length = 0;
+	c.in_id = 0;
+	c.queued = 0;
+	c.out_bytes = 0;
+	c.out_watched = false;
+	c.legacy = false;
+
+	peers[dst_path] = socket_fd;
+
+	return true;
 }
 
 bool DomainServer::setBlockingMode(bool block)
@@ -109,25 +197,33 @@ bool DomainServer::blockingMode() const
 
 bool DomainServer::sendto(const string& dst_path, const Bundle & bundle)
 {
-	unsigned char * buf = tmpBuf;
-	int bufSize = sizeof(tmpBuf);
-	if (bundle.byteCount() > bufSize)
+	// old peers get format v1
+	Connection * c = find_connection(dst_path.empty() ? client_path : dst_path);
+	if (c != NULL && c->legacy)
 	{
-		bufSize = bundle.byteCount();
-		buf = new unsigned char[bufSize];
+		string data;
+
+		if (!bundle.exportLegacy(data))
+		{
+			DD("sendto(%s) failed: bundle does not fit format v1\n",
+					c->peer.c_str());
+			return false;
+		}
+
+		return sendto(dst_path, data) == (int) data.size();
 	}
 
-	int len = bundle.exportData(buf, bufSize);
-	if (len < 0)
+	struct iovec iov[MAX_REGIONS];
+
+	int count = bundle.exportRegions(iov, MAX_REGIONS);
+	if (count < 0)
 		return false;
 
-	bool b = (len == sendto(dst_path, buf, len));
-	if (buf != tmpBuf)
-	{
-		delete[] buf;
-		buf = NULL;
-	}
-	return b;
+	int size = 0;
+	for (int i = 0; i < count; ++i)
+		size += iov[i].iov_len;
+
+	return sendmsg(dst_path, iov, count) == size;
 }
 
 int DomainServer::sendto(const string & dst_path, const char* buf,
@@ -139,7 +235,17 @@ int DomainServer::sendto(const string & dst_path, const char* buf,
 int DomainServer::sendto(const string & dst_path, const unsigned char* buf,
 		const int size)
 {
-	if (!b_open)
+	struct iovec iov;
+	iov.iov_base = (void *) buf;
+	iov.iov_len = (size < 0) ? ::strlen((const char *) buf) + 1 : size; // +1 for '\0'
+
+	return sendmsg(dst_path, &iov, 1);
+}
+
+int DomainServer::sendmsg(const string & dst_path, const struct iovec * iov,
+		const int iovcnt)
+{
+	if (!b_open || iovcnt < 0 || iovcnt > MAX_REGIONS)
 		return -1;
 
 	const string & dst_client_path =
@@ -150,26 +256,39 @@ int DomainServer::sendto(const string & dst_path, const unsigned char* buf,
 		throw std::invalid_argument(
 				"DomainServer::sendto last client is not available");
 
-	// destination address
-	::memset(&client_address, 0, sizeof(client_address));
-	client_address.sun_family = AF_UNIX;
-	client_address.sun_path[0] = 0;
-	strcpy(client_address.sun_path + 1, dst_client_path.c_str());
+	string peer;
+	uint32_t request_id = split_address(dst_client_path, peer);
+
+	// client connects on first message
+	if (!listening && !connect(peer))
+		return -1;
+
+	map<string, int>::const_iterator it = peers.find(peer);
+	if (it == peers.end())
+	{
+		DD("sendto(%s) failed: not connected\n", dst_client_path.c_str());
+		return -1;
+	}
 
 	client_path = dst_client_path;
 
-	size_t bsize = (size < 0) ? ::strlen((const char *) buf) + 1 : size; // +1 for '\0'
+	size_t size = 0;
+	for (int i = 0; i < iovcnt; ++i)
+		size += iov[i].iov_len;
 
-	int wlen = ::sendto(socket_fd, buf, bsize, 0,
-			(struct sockaddr *) &client_address, address_length);
+	Connection & c = connections[it->second];
 
-	if (wlen < 0)
+	if (!send_message(c, request_id, iov, iovcnt, size))
 	{
-		DD("sendto(%d, %s) failed: %s\n", socket_fd, dst_client_path.c_str(),
+		DD("sendto(%d, %s) failed: %s\n", c.fd, dst_client_path.c_str(),
 				strerror(errno));
+		close_connection(c.fd);
+		return -1;
 	}
 
-	return wlen;
+	update_events(c);
+
+	return size;
 }
 
 int DomainServer::sendto(const string & dst_path, const string & str)
@@ -194,24 +313,54 @@ int DomainServer::reply(const unsigned char * buf, const int size)
 
 int DomainServer::reply(const string & str)
 {
-	::strcpy((char *) tmpBuf, str.c_str());
-
-	return sendto("", tmpBuf, str.length());
+	return sendto("", str);
 }
 
 bool DomainServer::recvfrom(string& src_path, Bundle& bundle)
 {
-	int len = recvfrom(src_path, tmpBuf, sizeof(tmpBuf));
+	return recvfrom(src_path, bundle, listening ? 0 : LLONG_MAX);
+}
 
-	if (len < 0)
+bool DomainServer::recvfrom(string& src_path, Bundle& bundle,
+		const long long milliseconds)
+{
+	string data;
+
+	if (!receive(src_path, data, milliseconds))
 		return false;
 
-	if (!bundle.importData(tmpBuf, len))
+	if (!bundle.importData((const unsigned char *) data.data(), data.size()))
 		return false;
 
+	set_format(src_path, data);
+
 	return true;
 }
 
+bool DomainServer::recvfrom(string& src_path, BundleView& view)
+{
+	view.clear();
+
+	if (!receive(src_path, received, listening ? 0 : LLONG_MAX))
+		return false;
+
+	set_format(src_path, received);
+
+	if (view.set((const unsigned char *) received.data(), received.size()))
+		return true;
+
+	// format v1 of old peers is converted
+	Bundle bundle;
+	if (!bundle.importData((const unsigned char *) received.data(),
+			received.size()))
+		return false;
+
+	received.resize(bundle.byteCount() + 1);
+	bundle.exportData((unsigned char *) &received[0], received.size());
+
+	return view.set((const unsigned char *) received.data(), received.size());
+}
+
 int DomainServer::recvfrom(string& src_path, char* buf, const int size)
 {
 	return recvfrom(src_path, (unsigned char *) buf, size);
@@ -219,148 +368,680 @@ int DomainServer::recvfrom(string& src_path, char* buf, const int size)
 
 int DomainServer::recvfrom(string& src_path, unsigned char* buf, const int size)
 {
-	if (!b_open)
+	string data;
+
+	if (!receive(src_path, data, listening ? 0 : LLONG_MAX))
 		return -1;
 
-	int rlen = ::recvfrom(socket_fd, buf, size, 0,
-			(struct sockaddr *) &client_address, &address_length);
+	int len = (data.size() < (size_t) size) ? data.size() : size;
+	::memcpy(buf, data.data(), len);
+
+	return len;
+}
+
+int DomainServer::recvfrom(string & src_path, string & response)
+{
+	if (!receive(src_path, response, listening ? 0 : LLONG_MAX))
+		return -1;
+
+	// strip '\0' of strings sent with size -1
+	if (!response.empty() && response[response.size() - 1] == '\0')
+		response.resize(response.size() - 1);
+
+	return response.size();
+}
+
+bool DomainServer::receive(string & src_path, string & data,
+		const long long milliseconds)
+{
+	if (!b_open)
+		return false;
+
+	if (messages.empty() && listening)
+		poll_events();
+
+	// client: read connection until a message is complete
+	uint64_t start = Timer::getCurrentClock();
 
-	if (rlen > 0)
+	while (messages.empty() && !listening && !connections.empty())
 	{
-		src_path = (client_address.sun_path + 1);
+		Connection & c = connections.begin()->second;
+
+		if (!read_packets(c))
+		{
+			close_connection(c.fd);
+			break;
+		}
 
-		if (src_path.empty())
-			DD("recvfrom() : source path is empty\n");
+		if (!messages.empty())
+			break;
 
-		client_path = src_path;
+		long long remaining = milliseconds;
+		if (milliseconds != LLONG_MAX)
+		{
+			remaining = milliseconds - (long long) (Timer::getCurrentClock() - start);
+			if (remaining <= 0)
+				return false;
+		}
+
+		if (!wait_readable(c.fd, remaining))
+			return false;
 	}
 
-	return rlen;
+	if (messages.empty())
+		return false;
+
+	src_path = messages.front().first;
+	data.swap(messages.front().second);
+	messages.pop_front();
+
+	// connection may be closed meanwhile
+	Connection * c = find_connection(src_path);
+	if (c != NULL && c->queued > 0)
+		--c->queued;
+
+	client_path = src_path;
+
+	return true;
 }
 
-int DomainServer::recvfrom(string & src_path, string & response)
+void DomainServer::poll_events()
+{
+	struct epoll_event events[DOMAINSERVER_MAX_EVENTS];
+
+	int n = ::epoll_wait(epoll_fd, events, DOMAINSERVER_MAX_EVENTS, 0);
+	if (n < 0 && errno != EINTR)
+		DD("epoll_wait() failed: %s\n", strerror(errno));
+
+	for (int i = 0; i < n; ++i)
+	{
+		if (events[i].data.fd == socket_fd)
+		{
+			accept_connections();
+			continue;
+		}
+
+		// connection may be closed by a previous event
+		map<int, Connection>::iterator it = connections.find(events[i].data.fd);
+		if (it != connections.end())
+			process(it->second, events[i].events);
+	}
+}
+
+void DomainServer::accept_connections()
 {
-	int len = this->recvfrom(src_path, tmpBuf, sizeof(tmpBuf));
+	while (true)
+	{
+		struct sockaddr_un address;
+		socklen_t length = sizeof(address);
 
-	if (len <= 0)
-		return len;
+		::memset(&address, 0, sizeof(address));
 
-	tmpBuf[len] = '\0';
+		int fd = ::accept4(socket_fd, (struct sockaddr *) &address, &length,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				DD("accept4() failed: %s\n", strerror(errno));
+			return;
+		}
 
-	response.assign((char *) tmpBuf);
+		// accept() does not return the peer address for sockets
+		length = sizeof(address);
+		if (::getpeername(fd, (struct sockaddr *) &address, &length) < 0)
+			length = 0;
 
-	return len;
+		string peer;
+		if (length > sizeof(address.sun_family) + 1)
+			peer = address.sun_path + 1;
+
+		// unbound peer, replies still need an address
+		if (peer.empty())
+		{
+			char name[32];
+			::snprintf(name, sizeof(name), "#anonymous-%u", ++anonymous_peers);
+			peer = name;
+		}
+
+		struct epoll_event ev;
+		::memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN;
+		ev.data.fd = fd;
+
+		if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		{
+			DD("epoll_ctl(ADD) failed: %s\n", strerror(errno));
+			::close(fd);
+			continue;
+		}
+
+		Connection & c = connections[fd];
+		c.fd = fd;
+		c.peer = peer;
+		c.in_length = 0;
+		c.in_id = 0;
+		c.queued = 0;
+		c.out_bytes = 0;
+		c.out_watched = false;
+		c.legacy = false;
+
+		peers[peer] = fd;
+	}
 }
 
-//bool DomainServer::query(const string & dst_path, const Bundle & toSend, Bundle & toReceive, const long long milliseconds)
-//{
-//	clear();
-//
-//	if (!sendto(dst_path, toSend))
-//		return false;
-//
-//	Timer timer;
-//	string src;
-//
-//	timer.set(milliseconds);
-//
-//	while (true)
-//	{
-//		if (timer.isTimeout())
-//			return false;
-//
-//		if (recvfrom(src, toReceive))
-//			break;
-//
-//		usleep(100000);
-//	} // end-of-while timeout
-//
-//	return true;
-//}
+void DomainServer::process(Connection & c, uint32_t events)
+{
+	int fd = c.fd;
 
-bool DomainServer::query(const string & dst_path, const Bundle & toSend,
-		Bundle & toReceive, const long long milliseconds)
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !read_packets(c))
+	{
+		close_connection(fd);
+		return;
+	}
+
+	if (events & EPOLLOUT)
+	{
+		if (!flush(c))
+		{
+			close_connection(fd);
+			return;
+		}
+
+		update_events(c);
+	}
+}
+
+bool DomainServer::read_packets(Connection & c)
 {
-	clear();
+	// client reads a packet at a time
+	int batch = ring.empty() ? 1 : BATCH_SIZE;
+	unsigned char * base = ring.empty() ? tmpBuf : &ring[0];
 
-	if (!sendto(dst_path, toSend))
-		return false;
+	struct mmsghdr msgs[BATCH_SIZE];
+	struct iovec iov[BATCH_SIZE];
 
-	string src;
-	fd_set fd_read;
-	struct timeval tv;
+	while (true)
+	{
+		::memset(msgs, 0, sizeof(msgs));
+
+		for (int i = 0; i < batch; ++i)
+		{
+			iov[i].iov_base = base + i * PACKET_SIZE;
+			iov[i].iov_len = PACKET_SIZE;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
 
-	tv.tv_sec = milliseconds / 1000;
-	tv.tv_usec = (milliseconds - tv.tv_sec * 1000) * 1000;
+		int n = ::recvmmsg(c.fd, msgs, batch, MSG_DONTWAIT, NULL);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
 
-	FD_ZERO(&fd_read);
-	FD_SET(socket_fd, &fd_read);
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
 
-	int rc = ::select(socket_fd + 1, &fd_read, (fd_set *) NULL, (fd_set *) NULL,
-			&tv);
-	if (rc == 0)
+		for (int i = 0; i < n; ++i)
+		{
+			// peer closed connection
+			if (msgs[i].msg_len == 0)
+				return false;
+
+			if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+			{
+				DD("recv(%s) failed: packet too large\n", c.peer.c_str());
+				return false;
+			}
+
+			if (!read_packet(c, base + i * PACKET_SIZE, msgs[i].msg_len))
+				return false;
+		}
+
+		// nothing more to read for now
+		if (batch > 1 && n < batch)
+			return true;
+	}
+}
+
+bool DomainServer::read_packet(Connection & c, const unsigned char * data,
+		size_t size)
+{
+	// first packet of a message starts with message length
+	if (c.in_length == 0)
 	{
-		// timeout
+		if (size < HEADER_SIZE)
+		{
+			DD("recv(%s) failed: invalid header\n", c.peer.c_str());
+			return false;
+		}
 
-		return false;
+		c.in_length = ((size_t) data[0] << 24) | (data[1] << 16)
+				| (data[2] << 8) | data[3];
+		c.in_id = ((uint32_t) data[4] << 24) | (data[5] << 16)
+				| (data[6] << 8) | data[7];
+		c.in.clear();
+
+		data += HEADER_SIZE;
+		size -= HEADER_SIZE;
+
+		if (listening && c.in_length > MAX_MESSAGE_SIZE)
+		{
+			DD("recv(%s) failed: message too large\n", c.peer.c_str());
+			return false;
+		}
+
+		if (c.in_length == 0)
+			return queue_received(c);
 	}
-	else if (rc < 0)
+
+	c.in.append((const char *) data, size);
+
+	if (c.in.size() > c.in_length)
 	{
-		DD("select() failed: %s\n", strerror(errno));
+		DD("recv(%s) failed: message too long\n", c.peer.c_str());
 		return false;
 	}
 
-	// now, rc > 0
+	if (c.in.size() == c.in_length)
+	{
+		c.in_length = 0;
+		return queue_received(c);
+	}
+
+	return true;
+}
 
-	if (!FD_ISSET(socket_fd, &fd_read))
+bool DomainServer::queue_received(Connection & c)
+{
+	if (listening && c.queued >= MAX_QUEUED_MESSAGES)
+	{
+		DD("recv(%s) failed: too many messages queued\n", c.peer.c_str());
 		return false;
+	}
 
-	return recvfrom(src, toReceive);
-}
-
-//void DomainServer::clear()
-//{
-//	bool b_blocking = blockingMode();
-//
-//	// change to nonblocking
-//	if (b_blocking)
-//		this->setBlockingMode(false);
-//
-//	string src;
-//	char ch;
-//
-//	// drain receive buffer
-//	while (this->recvfrom(src, &ch, 1) > 0);
-//
-//	// reset blocking mode
-//	if (b_blocking)
-//		this->setBlockingMode(true);
-//}
+	messages.push_back(make_pair(reply_address(c.peer, c.in_id), string()));
+	messages.back().second.swap(c.in);
+	++c.queued;
 
-void DomainServer::clear()
+	return true;
+}
+
+bool DomainServer::send_message(Connection & c, const uint32_t request_id,
+		const struct iovec * iov, const int iovcnt, const size_t size)
+{
+	// keep order behind queued packets
+	if (!c.out.empty())
+	{
+		queue_message(c, request_id, iov, iovcnt, size, 0);
+		return flush(c);
+	}
+
+	// server never blocks, client waits until sent
+	int flags = MSG_NOSIGNAL | (listening ? MSG_DONTWAIT : 0);
+
+	unsigned char header[HEADER_SIZE];
+	make_header(header, size, request_id);
+
+	struct iovec parts[MAX_REGIONS + 1];
+	size_t offset = 0;
+
+	while (true)
+	{
+		int count = 0;
+		size_t n = PACKET_SIZE;
+
+		if (offset == 0)
+		{
+			parts[count].iov_base = header;
+			parts[count].iov_len = HEADER_SIZE;
+			++count;
+			n -= HEADER_SIZE;
+		}
+
+		if (n > size - offset)
+			n = size - offset;
+
+		count += gather(iov, iovcnt, offset, n, parts + count);
+
+		struct msghdr msg;
+		::memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = parts;
+		msg.msg_iovlen = count;
+
+		if (::sendmsg(c.fd, &msg, flags) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return false;
+
+			// socket is full, rest is sent when it gets writable
+			queue_message(c, request_id, iov, iovcnt, size, offset);
+			return true;
+		}
+
+		offset += n;
+		if (offset >= size)
+			return true;
+	}
+}
+
+void DomainServer::queue_message(Connection & c, const uint32_t request_id,
+		const struct iovec * iov, const int iovcnt, const size_t size,
+		size_t offset)
+{
+	struct iovec parts[MAX_REGIONS];
+
+	do
+	{
+		string packet;
+
+		if (offset == 0)
+		{
+			unsigned char header[HEADER_SIZE];
+			make_header(header, size, request_id);
+			packet.append((const char *) header, HEADER_SIZE);
+		}
+
+		size_t n = PACKET_SIZE - packet.size();
+		if (n > size - offset)
+			n = size - offset;
+
+		packet.reserve(packet.size() + n);
+
+		int count = gather(iov, iovcnt, offset, n, parts);
+		for (int i = 0; i < count; ++i)
+			packet.append((const char *) parts[i].iov_base, parts[i].iov_len);
+
+		offset += n;
+
+		c.out_bytes += packet.size();
+		c.out.push_back(string());
+		c.out.back().swap(packet);
+	} while (offset < size);
+}
+
+int DomainServer::gather(const struct iovec * iov, const int iovcnt,
+		size_t offset, size_t length, struct iovec * parts)
 {
-	int bytesAvailable;
+	int count = 0;
 
-	// get the number of bytes in input buffer
-	if (::ioctl(socket_fd, FIONREAD, &bytesAvailable) < 0)
+	for (int i = 0; i < iovcnt && length > 0; ++i)
 	{
-		DD("ioctl(FIONREAD) failed: %s\n", strerror(errno));
+		// skip regions before offset
+		if (offset >= iov[i].iov_len)
+		{
+			offset -= iov[i].iov_len;
+			continue;
+		}
+
+		size_t n = iov[i].iov_len - offset;
+		if (n > length)
+			n = length;
+
+		parts[count].iov_base = (char *) iov[i].iov_base + offset;
+		parts[count].iov_len = n;
+		++count;
+
+		length -= n;
+		offset = 0;
+	}
+
+	return count;
+}
+
+void DomainServer::make_header(unsigned char * header, const size_t size,
+		const uint32_t request_id)
+{
+	// message length and request id, big endian
+	header[0] = (size >> 24) & 0xFF;
+	header[1] = (size >> 16) & 0xFF;
+	header[2] = (size >> 8) & 0xFF;
+	header[3] = size & 0xFF;
+	header[4] = (request_id >> 24) & 0xFF;
+	header[5] = (request_id >> 16) & 0xFF;
+	header[6] = (request_id >> 8) & 0xFF;
+	header[7] = request_id & 0xFF;
+}
+
+bool DomainServer::flush(Connection & c)
+{
+	// server never blocks, client waits until sent
+	int flags = MSG_NOSIGNAL | (listening ? MSG_DONTWAIT : 0);
+
+	struct mmsghdr msgs[BATCH_SIZE];
+	struct iovec iov[BATCH_SIZE];
+
+	while (!c.out.empty())
+	{
+		::memset(msgs, 0, sizeof(msgs));
+
+		int n = 0;
+		for (deque<string>::const_iterator it = c.out.begin();
+				it != c.out.end() && n < BATCH_SIZE; ++it, ++n)
+		{
+			iov[n].iov_base = (void *) it->data();
+			iov[n].iov_len = it->size();
+			msgs[n].msg_hdr.msg_iov = &iov[n];
+			msgs[n].msg_hdr.msg_iovlen = 1;
+		}
+
+		int r = ::sendmmsg(c.fd, msgs, n, flags);
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+
+		for (int i = 0; i < r; ++i)
+		{
+			c.out_bytes -= c.out.front().size();
+			c.out.pop_front();
+		}
+
+		// socket is full, rest is sent when it gets writable
+		if (r < n && listening)
+			return true;
+	}
+
+	return true;
+}
+
+void DomainServer::update_events(Connection & c)
+{
+	if (!listening || c.out_watched == !c.out.empty())
+		return;
+
+	c.out_watched = !c.out.empty();
+
+	struct epoll_event ev;
+	::memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | (c.out_watched ? (uint32_t) EPOLLOUT : 0u);
+	ev.data.fd = c.fd;
+
+	if (::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, c.fd, &ev) < 0)
+		DD("epoll_ctl(MOD) failed: %s\n", strerror(errno));
+}
+
+void DomainServer::close_connection(int fd)
+{
+	map<int, Connection>::iterator it = connections.find(fd);
+	if (it == connections.end())
 		return;
+
+	map<string, int>::iterator p = peers.find(it->second.peer);
+	if (p != peers.end() && p->second == fd)
+		peers.erase(p);
+
+	connections.erase(it);
+
+	// client connection is the socket itself
+	if (fd == socket_fd)
+		socket_fd = -1;
+
+	// epoll removes closed fds itself
+	::close(fd);
+}
+
+bool DomainServer::wait_readable(int fd, const long long milliseconds)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	int timeout = (milliseconds >= INT_MAX) ? -1 : (int) milliseconds;
+
+	int rc = ::poll(&pfd, 1, timeout);
+	if (rc < 0 && errno != EINTR)
+		DD("poll() failed: %s\n", strerror(errno));
+
+	return rc > 0;
+}
+
+bool DomainServer::query(const string & dst_path, const Bundle & toSend,
+		Bundle & toReceive, const long long milliseconds)
+{
+	clear();
+
+	// 0 means untagged
+	if (++last_request_id == 0)
+		++last_request_id;
+
+	string address = reply_address(dst_path, last_request_id);
+
+	if (!sendto(address, toSend))
+		return false;
+
+	uint64_t start = Timer::getCurrentClock();
+	string src, data;
+
+	// late replies of earlier (timed out) queries are dropped
+	while (true)
+	{
+		long long remaining = milliseconds;
+		if (milliseconds != LLONG_MAX)
+		{
+			remaining = milliseconds - (long long) (Timer::getCurrentClock() - start);
+			if (remaining < 0)
+				return false;
+		}
+
+		if (!receive(src, data, remaining))
+			return false;
+
+		if (src == address)
+			break;
+	}
+
+	return toReceive.importData((const unsigned char *) data.data(),
+			data.size());
+}
+
+size_t DomainServer::pending(const std::string & dst_path) const
+{
+	string peer;
+	split_address(dst_path, peer);
+
+	map<string, int>::const_iterator it = peers.find(peer);
+	if (it == peers.end())
+		return 0;
+
+	map<int, Connection>::const_iterator c = connections.find(it->second);
+	if (c == connections.end())
+		return 0;
+
+	return c->second.out_bytes;
+}
+
+std::string DomainServer::reply_address(const std::string & path,
+		const uint32_t request_id)
+{
+	if (request_id == 0)
+		return path;
+
+	char id[16];
+	::snprintf(id, sizeof(id), "#%u", request_id);
+
+	return path + id;
+}
+
+DomainServer::Connection * DomainServer::find_connection(
+		const std::string & address)
+{
+	string peer;
+	split_address(address, peer);
+
+	map<string, int>::const_iterator it = peers.find(peer);
+	if (it == peers.end())
+		return NULL;
+
+	return &connections[it->second];
+}
+
+void DomainServer::set_format(const std::string & src_path,
+		const std::string & data)
+{
+	Connection * c = find_connection(src_path);
+
+	if (c != NULL)
+		c->legacy = data.empty() || (unsigned char) data[0] != Bundle::FORMAT_V2;
+}
+
+uint32_t DomainServer::split_address(const std::string & address,
+		std::string & path)
+{
+	size_t pos = address.rfind('#');
+
+	// "#anonymous-1" etc. are peer addresses, ids are decimal only
+	if (pos == string::npos || pos + 1 == address.size()
+			|| address.find_first_not_of("0123456789", pos + 1) != string::npos)
+	{
+		path = address;
+		return 0;
 	}
 
-	// clear if data available
-	if (bytesAvailable > 0)
+	path = address.substr(0, pos);
+
+	return (uint32_t) ::strtoul(address.c_str() + pos + 1, NULL, 10);
+}
+
+void DomainServer::clear()
+{
+	// read what is available (late replies), then drop
+	if (!listening && !connections.empty())
 	{
-		char buf[bytesAvailable];
-		string src;
-		this->recvfrom(src, buf, bytesAvailable);
+		Connection & c = connections.begin()->second;
+		if (!read_packets(c))
+			close_connection(c.fd);
 	}
+
+	messages.clear();
+
+	for (map<int, Connection>::iterator it = connections.begin();
+			it != connections.end(); ++it)
+		it->second.queued = 0;
 }
 
 void DomainServer::close()
 {
-	if (b_open)
+	while (!connections.empty())
+		close_connection(connections.begin()->first);
+
+	messages.clear();
+
+	if (socket_fd >= 0)
 		::close(socket_fd);
+	socket_fd = -1;
+
+	if (epoll_fd >= 0)
+		::close(epoll_fd);
+	epoll_fd = -1;
 
+	listening = false;
 	b_open = false;
 }
@@ -1,6 +1,6 @@
 #include "Timer.h"
 
-#include <sys/timeb.h>
+#include <time.h>
 
 Timer::Timer()
 {
@@ -40,10 +40,12 @@ void Timer::reset()
 
 uint64_t Timer::getCurrentClock()
 {
-	struct timeb currentTime;
+	struct timespec currentTime;
 
-	ftime(&currentTime);
+	// monotonic, not affected by wall clock changes
+	clock_gettime(CLOCK_MONOTONIC, &currentTime);
 
-	return (uint64_t) ((currentTime.time * 1000) + (currentTime.millitm));
+	return (uint64_t) ((currentTime.tv_sec * 1000)
+			+ (currentTime.tv_nsec / 1000000));
 }
 
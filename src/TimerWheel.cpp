@@ -0,0 +1,349 @@
+#include "TimerWheel.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include "Debug.h"
+#include "Timer.h"
+
+using namespace std;
+
+#define SLOT_MASK				((uint64_t) TimerWheel::SLOTS - 1)
+
+/** @brief rotate right, n in [0, 64) */
+static inline uint64_t rotr64(const uint64_t v, const int n)
+{
+	return n == 0 ? v : (v >> n) | (v << (64 - n));
+}
+
+TimerWheel::TimerWheel(const uint64_t resolution) :
+		resolution(resolution ? resolution : 1), tick(0), armed_tick(0), timer_fd(
+				-1), pending_count(0)
+{
+	for (int i = 0; i < LEVELS * SLOTS; ++i)
+		heads[i] = -1;
+
+	for (int i = 0; i < LEVELS; ++i)
+		occupied[i] = 0;
+
+	tick = current_tick();
+}
+
+TimerWheel::~TimerWheel()
+{
+	close();
+}
+
+bool TimerWheel::open()
+{
+	close();
+
+	timer_fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0)
+	{
+		DD("timerfd_create() failed: %s\n", strerror(errno));
+		return false;
+	}
+
+	armed_tick = 0;
+
+	arm();
+
+	return true;
+}
+
+void TimerWheel::close()
+{
+	if (timer_fd >= 0)
+		::close(timer_fd);
+
+	timer_fd = -1;
+}
+
+TimerWheel::timer_id TimerWheel::add(const uint64_t delay,
+		const int type, const std::string & key)
+{
+	int index;
+
+	if (free_nodes.empty())
+	{
+		index = nodes.size();
+		nodes.push_back(Node());
+		nodes[index].generation = 0;
+	}
+	else
+	{
+		index = free_nodes.back();
+		free_nodes.pop_back();
+	}
+
+	Node & n = nodes[index];
+
+	uint64_t now = current_tick();
+	if (now < tick)
+		now = tick;
+
+	// empty wheel catches up at once, the idle rounds are not walked later
+	if (pending_count == 0)
+		tick = now;
+
+	// round up, timer never fires early
+	n.expires = now + (delay + resolution - 1) / resolution;
+	n.type = type;
+	n.key = key;
+	++n.generation;
+
+	insert(index);
+	++pending_count;
+
+	arm();
+
+	return ((timer_id) n.generation << 32) | (uint32_t) index;
+}
+
+bool TimerWheel::cancel(const timer_id id)
+{
+	if (!pending(id))
+		return false;
+
+	int index = (int) (id & 0xFFFFFFFF);
+
+	unlink(index);
+	release(index);
+
+	// timerfd is left armed, an early wakeup just finds nothing due
+
+	return true;
+}
+
+bool TimerWheel::pending(const timer_id id) const
+{
+	size_t index = (size_t) (id & 0xFFFFFFFF);
+	uint32_t generation = (uint32_t) (id >> 32);
+
+	if (id == 0 || index >= nodes.size())
+		return false;
+
+	return nodes[index].slot >= 0 && nodes[index].generation == generation;
+}
+
+void TimerWheel::expire(std::vector<Expired> & expired)
+{
+	uint64_t expirations;
+
+	if (::read(timer_fd, &expirations, sizeof(expirations)) < 0
+			&& errno != EAGAIN)
+		DD("read(timerfd) failed: %s\n", strerror(errno));
+
+	// one-shot timer is not armed anymore
+	armed_tick = 0;
+
+	advance(current_tick(), expired);
+
+	arm();
+}
+
+void TimerWheel::advance(const uint64_t now, std::vector<Expired> & expired)
+{
+	while (tick < now)
+	{
+		// next occupied slot of level 0 in this round, or the round end
+		uint64_t next = (tick | SLOT_MASK) + 1;
+		int index = (int) (tick & SLOT_MASK);
+
+		if (index != SLOTS - 1)
+		{
+			uint64_t mask = occupied[0] & (~0ULL << (index + 1));
+			if (mask)
+				next = (tick & ~SLOT_MASK) + __builtin_ctzll(mask);
+		}
+
+		if (next > now)
+		{
+			tick = now;
+			break;
+		}
+
+		tick = next;
+
+		// cascade higher levels at the beginning of each round
+		for (int level = 1; level < LEVELS && (tick & SLOT_MASK) == 0; ++level)
+		{
+			cascade(level);
+
+			if ((tick >> (level * SLOT_BITS)) & SLOT_MASK)
+				break;
+		}
+
+		// fire timers of the current slot
+		int slot = (int) (tick & SLOT_MASK);
+		while (heads[slot] >= 0)
+		{
+			int i = heads[slot];
+			Node & n = nodes[i];
+
+			unlink(i);
+
+			// clamped timers may come back before they are due
+			if (n.expires > tick)
+			{
+				insert(i);
+				continue;
+			}
+
+			Expired e;
+			e.id = ((timer_id) n.generation << 32) | (uint32_t) i;
+			e.type = n.type;
+			e.key = n.key;
+			expired.push_back(e);
+
+			release(i);
+		}
+	}
+}
+
+bool TimerWheel::next_tick(uint64_t & next) const
+{
+	bool found = false;
+
+	for (int level = 0; level < LEVELS; ++level)
+	{
+		if (occupied[level] == 0)
+			continue;
+
+		int shift = level * SLOT_BITS;
+		int index = (int) ((tick >> shift) & SLOT_MASK);
+
+		// distance (1..SLOTS) to the next occupied slot after the current one
+		uint64_t rotated = rotr64(occupied[level], (index + 1) & (int) SLOT_MASK);
+		uint64_t distance = __builtin_ctzll(rotated) + 1;
+
+		// level 0 slot is the expiry tick, higher slots are cascade ticks
+		uint64_t t = ((tick >> shift) + distance) << shift;
+
+		if (!found || t < next)
+			next = t;
+		found = true;
+	}
+
+	return found;
+}
+
+uint64_t TimerWheel::current_tick() const
+{
+	return Timer::getCurrentClock() / resolution;
+}
+
+void TimerWheel::insert(const int index, const bool current)
+{
+	Node & n = nodes[index];
+
+	// due timers fire on the next tick, or on this one while cascading
+	uint64_t due = current ? tick : tick + 1;
+	uint64_t expires = (n.expires > due) ? n.expires : due;
+	uint64_t delta = expires - tick;
+
+	int level = 0;
+	while (level < LEVELS - 1 && delta >= (1ULL << ((level + 1) * SLOT_BITS)))
+		++level;
+
+	// clamp very long delays into the last slot of the top level
+	if (delta >= (1ULL << (LEVELS * SLOT_BITS)))
+		expires = tick + (1ULL << (LEVELS * SLOT_BITS)) - 1;
+
+	int slot = (int) ((expires >> (level * SLOT_BITS)) & SLOT_MASK);
+	int s = level * SLOTS + slot;
+
+	n.slot = s;
+	n.prev = -1;
+	n.next = heads[s];
+
+	if (heads[s] >= 0)
+		nodes[heads[s]].prev = index;
+
+	heads[s] = index;
+	occupied[level] |= (1ULL << slot);
+}
+
+void TimerWheel::unlink(const int index)
+{
+	Node & n = nodes[index];
+	int s = n.slot;
+
+	if (n.prev >= 0)
+		nodes[n.prev].next = n.next;
+	else
+		heads[s] = n.next;
+
+	if (n.next >= 0)
+		nodes[n.next].prev = n.prev;
+
+	if (heads[s] < 0)
+		occupied[s / SLOTS] &= ~(1ULL << (s % SLOTS));
+
+	n.slot = -1;
+	n.prev = n.next = -1;
+}
+
+void TimerWheel::release(const int index)
+{
+	nodes[index].slot = -1;
+	nodes[index].key.clear();
+	free_nodes.push_back(index);
+
+	--pending_count;
+}
+
+void TimerWheel::cascade(const int level)
+{
+	int slot = (int) ((tick >> (level * SLOT_BITS)) & SLOT_MASK);
+	int s = level * SLOTS + slot;
+
+	// detach slot list, then re-insert relative to current tick
+	int i = heads[s];
+	heads[s] = -1;
+	occupied[level] &= ~(1ULL << slot);
+
+	while (i >= 0)
+	{
+		int next = nodes[i].next;
+
+		nodes[i].slot = -1;
+		insert(i, true);
+
+		i = next;
+	}
+}
+
+void TimerWheel::arm()
+{
+	if (timer_fd < 0)
+		return;
+
+	uint64_t next = 0;
+	next_tick(next);
+
+	// skip syscall if already armed for the same tick
+	if (next == armed_tick)
+		return;
+
+	armed_tick = next;
+
+	// zero value disarms the timer
+	struct itimerspec its;
+	::memset(&its, 0, sizeof(its));
+
+	if (next)
+	{
+		uint64_t ms = next * resolution;
+
+		its.it_value.tv_sec = ms / 1000;
+		its.it_value.tv_nsec = (ms % 1000) * 1000000;
+	}
+
+	if (::timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+		DD("timerfd_settime() failed: %s\n", strerror(errno));
+}
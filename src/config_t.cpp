@@ -1,6 +1,10 @@
 #include "config_t.h"
 
 #include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include <signal.h>
 
 #include "fileutils.h"
 #include "Debug.h"
@@ -20,6 +24,13 @@
 #define KEYWORD_RESPAWN						"respawn"
 #define KEYWORD_RESPAWN__LIMIT				"limit"    // use with respawn
 
+#define KEYWORD_REQUIRES					"requires"
+#define KEYWORD_AFTER						"after"
+
+#define KEYWORD_STOP						"stop"
+#define KEYWORD_STOP__TIMEOUT				"timeout"  // use with stop
+#define KEYWORD_STOP__SIGNAL				"signal"   // use with stop
+
 using namespace std;
 
 const std::string config_t::null_device = "/dev/null";
@@ -156,6 +167,52 @@ bool config_t::import(const std::string& filepath)
 				return false;
 			}
 		}
+		else if (key == KEYWORD_REQUIRES || key == KEYWORD_AFTER)
+		{
+			if (parts.size() < 2)
+			{
+				DD("import() failed: no service in '%s'\n", key.c_str());
+				return false;
+			}
+
+			vector<string> & services =
+					(key == KEYWORD_REQUIRES) ?
+							required_services : after_services;
+
+			services.insert(services.end(), parts.begin() + 1, parts.end());
+		}
+		else if (key == KEYWORD_STOP && parts.size() > 1
+				&& parts[1] == KEYWORD_STOP__TIMEOUT)
+		{
+			if (parts.size() != 3)
+			{
+				DD("import() failed: error in 'stop timeout'\n");
+				return false;
+			}
+
+			stop_timeout = ::atoi(parts[2].c_str());
+			if (stop_timeout <= 0)
+			{
+				DD("import() failed: invalid value in 'stop timeout'\n");
+				return false;
+			}
+		}
+		else if (key == KEYWORD_STOP && parts.size() > 1
+				&& parts[1] == KEYWORD_STOP__SIGNAL)
+		{
+			if (parts.size() != 3)
+			{
+				DD("import() failed: error in 'stop signal'\n");
+				return false;
+			}
+
+			stop_signal = parse_signal(parts[2]);
+			if (stop_signal <= 0)
+			{
+				DD("import() failed: invalid value in 'stop signal'\n");
+				return false;
+			}
+		}
 	} // end-of-for lines
 
 	// check validity
@@ -173,11 +230,6 @@ bool config_t::import(const std::string& filepath)
 		pidfile = config_t::dirpath_pid + "/" + name + ".pid";
 	}
 
-	if (is_script)
-	{
-		script_filepath = string(DIRPATH_SERVICE_SCRIPTS "/") + name;
-	}
-
 	return true;
 }
 
@@ -208,16 +260,60 @@ void config_t::clear()
 	respawn_limit = 0;
 	respawn_interval = 0;
 
+	stop_timeout = default_stop_timeout;
+	stop_signal = SIGTERM;
+
+	required_services.clear();
+	after_services.clear();
+}
+
+int config_t::parse_signal(const std::string & s)
+{
+	static const struct
+	{
+		const char * name;
+		int signal;
+	} signals[] =
+	{
+	{ "HUP", SIGHUP },
+	{ "INT", SIGINT },
+	{ "QUIT", SIGQUIT },
+	{ "KILL", SIGKILL },
+	{ "USR1", SIGUSR1 },
+	{ "USR2", SIGUSR2 },
+	{ "TERM", SIGTERM } };
+
+	if (s.empty())
+		return -1;
+
+	// numeric
+	if (s.find_first_not_of("0123456789") == string::npos)
+	{
+		int sig = ::atoi(s.c_str());
+		return (sig > 0 && sig < NSIG) ? sig : -1;
+	}
+
+	string name = (s.compare(0, 3, "SIG") == 0) ? s.substr(3) : s;
+
+	for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); ++i)
+	{
+		if (name == signals[i].name)
+			return signals[i].signal;
+	}
+
+	return -1;
 }
 
 void config_t::writeToBundle(Bundle& bundle) const
 {
 	bundle << name << exec << onstop_exec << wipe_log << logfile << pidfile
-			<< respawn << respawn_limit << respawn_interval;
+			<< respawn << respawn_limit << respawn_interval << stop_timeout
+			<< stop_signal << required_services << after_services;
 }
 
 void config_t::readFromBundle(Bundle & bundle)
 {
 	bundle >> name >> exec >> onstop_exec >> wipe_log >> logfile >> pidfile
-			>> respawn >> respawn_limit >> respawn_interval;
+			>> respawn >> respawn_limit >> respawn_interval >> stop_timeout
+			>> stop_signal >> required_services >> after_services;
 }
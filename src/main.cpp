@@ -38,9 +38,9 @@ using namespace std;
  * @section related_files İlgili Dosyalar
  *
  * - DIRPATH_SERVICES      		: servislere ait config dosyalarının bulunduğu dizin
- * - DIRPATH_SERVICE_SCRIPTS	: servis script dosyalarının bulunduğu dizin
  * - DIRPATH_SERVICE_PIDS       : servislere ait pid dosyalarının bulunduğu dizin
  * - FILEPATH_SERVICES_LIST   	: çalışan servislerin listesini içeren dosya
+ * - FILEPATH_SERVICES_STATUS 	: servislerin durum tablosu (paylaşımlı bellek), status ve list komutları daemon'a sormadan okur
  *
  * @section config_file_format Config Dosyası Formatı
  *
@@ -85,6 +85,26 @@ using namespace std;
  *
  * respawn limit <limit>  <interval>
  *
+ *
+ * # time to wait for exit after stop signal before SIGKILL in milliseconds (default: 3000)
+ *
+ * stop timeout <milliseconds>
+ *
+ *
+ * # signal sent to stop service, name or number (default: SIGTERM)
+ *
+ * stop signal <signal>
+ *
+ *
+ * # services started before this one, start fails if one of them fails
+ *
+ * requires <service> [<service>...]
+ *
+ *
+ * # services started before this one when started together (e.g. start --all)
+ *
+ * after <service> [<service>...]
+ *
  * @endcode
  */
 
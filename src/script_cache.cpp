@@ -0,0 +1,134 @@
+#include "script_cache.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "Debug.h"
+
+#ifndef MFD_EXEC
+#define MFD_EXEC			0x0010U
+#endif
+
+using namespace std;
+
+script_cache::script_cache(const size_t limit) :
+		limit(limit ? limit : 1)
+{
+}
+
+script_cache::~script_cache()
+{
+	clear();
+}
+
+int script_cache::get(const std::string & name, const std::string & content)
+{
+	uint64_t key = hash(content);
+
+	map<uint64_t, entry>::iterator it = entries.find(key);
+	if (it != entries.end())
+	{
+		if (it->second.content == content)
+			return it->second.fd;
+
+		// hash collision, replace entry
+		::close(it->second.fd);
+		entries.erase(it);
+	}
+
+	int fd = create(name, content);
+	if (fd < 0)
+		return -1;
+
+	// fds are only used while spawning, any entry can be dropped
+	if (entries.size() >= limit)
+	{
+		::close(entries.begin()->second.fd);
+		entries.erase(entries.begin());
+	}
+
+	entry & e = entries[key];
+	e.fd = fd;
+	e.content = content;
+
+	return fd;
+}
+
+void script_cache::clear()
+{
+	for (map<uint64_t, entry>::iterator it = entries.begin();
+			it != entries.end(); ++it)
+		::close(it->second.fd);
+
+	entries.clear();
+}
+
+uint64_t script_cache::hash(const std::string & content)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < content.size(); ++i)
+	{
+		h ^= (unsigned char) content[i];
+		h *= 1099511628211ULL;
+	}
+
+	return h;
+}
+
+int script_cache::create(const std::string & name, const std::string & content)
+{
+	unsigned int flags = MFD_CLOEXEC | MFD_ALLOW_SEALING;
+
+	// MFD_EXEC is required if vm.memfd_noexec is set, unknown before 6.3
+	int fd = ::memfd_create(name.c_str(), flags | MFD_EXEC);
+	if (fd < 0 && errno == EINVAL)
+		fd = ::memfd_create(name.c_str(), flags);
+
+	if (fd < 0)
+	{
+		DD("memfd_create(%s) failed: %s\n", name.c_str(), strerror(errno));
+		return -1;
+	}
+
+	size_t n = 0;
+	while (n < content.size())
+	{
+		ssize_t r = ::write(fd, content.data() + n, content.size() - n);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r <= 0)
+		{
+			DD("write(memfd) failed: %s\n", strerror(errno));
+			::close(fd);
+			return -1;
+		}
+
+		n += r;
+	}
+
+	if (::fcntl(fd, F_ADD_SEALS,
+			F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0)
+	{
+		DD("fcntl(F_ADD_SEALS) failed: %s\n", strerror(errno));
+		::close(fd);
+		return -1;
+	}
+
+	// re-open read-only, exec fails with ETXTBSY while a writable fd exists
+	char path[64];
+	::snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+
+	int ro = ::open(path, O_RDONLY | O_CLOEXEC);
+	if (ro < 0)
+		DD("open(%s) failed: %s\n", path, strerror(errno));
+
+	::close(fd);
+
+	return ro;
+}
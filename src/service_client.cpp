@@ -2,15 +2,23 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <deque>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <vector>
 
 #include <ipc/ipc.h>
 
 #include "ServiceMessages.h"
 #include "service_server.h"
+#include "status_board.h"
+#include "fileutils.h"
 
 using namespace std;
 
@@ -22,9 +30,154 @@ using namespace std;
 #define CLI_COMMAND_STATUS							"status"
 #define CLI_COMMAND_SHOW							"show"
 #define CLI_COMMAND_LIST							"list"
+#define CLI_COMMAND_WATCH							"watch"
+#define CLI_COMMAND_SESSION							"-"
+
+#define CLI_OPTION_ALL								"--all"
+#define CLI_OPTION_JOBS								"-j"
+#define CLI_OPTION_FIELDS							"--fields"
+#define CLI_OPTION_CURSOR							"--cursor"
+#define CLI_OPTION_LIMIT							"--limit"
+
+/** @brief response timeout of queries in milliseconds */
+#define CLI_TIMEOUT_QUERY							5000
+/** @brief response timeout of stop/restart, covers service stop timeout */
+#define CLI_TIMEOUT_LIFECYCLE						60000
+
+/** @brief max requests in flight on one connection (session, status queries) */
+#define CLI_SESSION_WINDOW							64
 
 extern char * __progname;
 
+static bool name_less(const status_board::status & a,
+		const status_board::status & b)
+{
+	return a.name < b.name;
+}
+
+/** @brief Wait for a STATUS reply, state is kept if no reply */
+static void wait_status(AsyncClient & c, uint32_t & id, int & state)
+{
+	Bundle response;
+
+	if (id != 0 && c.wait(id, response, CLI_TIMEOUT_QUERY) && response.getBool())
+		state = response.getBool() ? service_t::ST_RUNNING : service_t::ST_STOPPED;
+
+	id = 0;
+}
+
+bool service_client::print_list_from_board()
+{
+	status_board board;
+
+	if (!board.open(FILEPATH_SERVICES_STATUS) || !board.complete())
+		return false;
+
+	vector<status_board::status> statuses;
+	board.read_all(statuses);
+
+	// daemon died while writing the board
+	if (board.abandoned())
+		return false;
+
+	std::sort(statuses.begin(), statuses.end(), name_less);
+
+	service_t s;
+
+	for (size_t i = 0; i < statuses.size(); ++i)
+	{
+		s.state = (service_t::State) statuses[i].state;
+
+		cout << statuses[i].name << ": ";
+		if (s.is_running())
+			cout << service_t::state_name(s.state) << ", process "
+					<< statuses[i].pid;
+		else
+			cout << service_t::state_name(s.state) << ".";
+		cout << endl;
+	}
+
+	return true;
+}
+
+int service_client::print_status(const std::vector<std::string> & names)
+{
+	status_board board;
+	bool has_board = board.open(FILEPATH_SERVICES_STATUS);
+
+	// state of services found on the board, queries for the others
+	vector<int> states(names.size(), -1);
+	vector<uint32_t> ids(names.size(), 0);
+	AsyncClient * c = NULL;
+	// queries in flight, in submit order
+	deque<size_t> pending;
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		status_board::status st;
+
+		// unknown service is stopped, but only a complete board knows it
+		if (has_board && board.find(names[i], st))
+		{
+			states[i] = st.state;
+			continue;
+		}
+
+		if (has_board && board.complete())
+		{
+			states[i] = service_t::ST_STOPPED;
+			continue;
+		}
+
+		if (c == NULL)
+		{
+			c = new AsyncClient(IPC_PATH_SERVICE);
+			if (!c->is_open())
+			{
+				cerr << "ERROR: Could not open client socket." << endl;
+				exit(1);
+			}
+		}
+
+		// daemon closes connections queueing too many requests
+		if (pending.size() >= CLI_SESSION_WINDOW)
+		{
+			size_t j = pending.front();
+			pending.pop_front();
+			wait_status(*c, ids[j], states[j]);
+		}
+
+		ids[i] = c->submit(Bundle() << SERVICE_CMD_STATUS << names[i]);
+		pending.push_back(i);
+	}
+
+	int rc = 0;
+	service_t s;
+
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+		if (states[i] < 0)
+			wait_status(*c, ids[i], states[i]);
+
+		if (states[i] < 0)
+		{
+			cerr << "ERROR: " << names[i] << ": Could not get response." << endl;
+			rc = 1;
+			continue;
+		}
+
+		s.state = (service_t::State) states[i];
+		cout << names[i] << " is "
+				<< (s.is_running() ? "running." :
+					s.state == service_t::ST_STARTING ? "starting." : "stopped.")
+				<< endl;
+	}
+
+	delete c;
+
+	return rc;
+}
+
 service_client::service_client()
 {
 }
@@ -34,13 +187,22 @@ void service_client::exit_with_usage(int exit_code)
 	cerr << __progname << " " << APP_VERSION << endl << "USAGE:" << endl << "\t"
 			<< __progname << "  -h" << endl << "\t" << __progname << "  -d"
 			<< endl << endl << "\t" << __progname << "  " << CLI_COMMAND_START
-			<< "  <service>" << endl << "\t" << __progname << "  "
-			<< CLI_COMMAND_STOP << "  <service>" << endl << "\t" << __progname
-			<< "  " << CLI_COMMAND_RESTART << "  <service>" << endl << "\t"
-			<< __progname << "  " << CLI_COMMAND_STATUS << "  <service>" << endl
-			<< "\t" << __progname << "  " << CLI_COMMAND_SHOW << "  <service>"
-			<< endl << "\t" << __progname << "  " << CLI_COMMAND_LIST << "  -v"
-			<< endl;
+			<< "  [-j <jobs>]  <service|pattern>...|--all" << endl << "\t"
+			<< __progname << "  " << CLI_COMMAND_STOP
+			<< "  [-j <jobs>]  <service|pattern>...|--all" << endl << "\t"
+			<< __progname << "  " << CLI_COMMAND_RESTART
+			<< "  [-j <jobs>]  <service|pattern>...|--all" << endl << "\t"
+			<< __progname << "  " << CLI_COMMAND_STATUS << "  <service>..." << endl
+			<< "\t" << __progname << "  " << CLI_COMMAND_SHOW << "  <service>..."
+			<< endl << "\t" << __progname << "  " << CLI_COMMAND_LIST
+			<< "  [-v | --fields <field,...>]  [--cursor <service>]  [--limit <count>]"
+			<< endl << "\t" << __progname << "  " << CLI_COMMAND_WATCH
+			<< "  [<service|pattern>...]" << endl << "\t" << __progname << "  "
+			<< CLI_COMMAND_SESSION << "  [<file>]" << endl << endl
+			<< "\tfields: name, state, pid, respawn_count, exit_code,"
+			<< " exit_signal, cpu_time, max_rss, exec, log, pidfile" << endl
+			<< endl << "\t-: run commands read line by line from stdin or"
+			<< " <file> over one connection" << endl;
 
 	::exit(exit_code);
 }
@@ -66,71 +228,266 @@ int service_client::process(int argc, char * argv[])
 		}
 	}
 
-	string command = argv[1];
-	string name = (argv[2] ? argv[2] : "");
-	Bundle bundle;
-	bool verbose = false;
-
-	if (command == CLI_COMMAND_START)
+	// batch mode: commands from stdin or a file over one connection
+	if (::strcmp(argv[1], CLI_COMMAND_SESSION) == 0)
 	{
-		if (argc != 3)
+		if (argc > 3)
 			service_client::exit_with_usage(1);
-		bundle << SERVICE_CMD_START << name;
+
+		if (argc == 2)
+			return run_session(cin);
+
+		ifstream ifs(argv[2]);
+		if (!ifs.is_open())
+		{
+			cerr << "ERROR: Could not open " << argv[2] << endl;
+			return 1;
+		}
+
+		return run_session(ifs);
 	}
-	else if (command == CLI_COMMAND_STOP)
+
+	command_line cl;
+	if (!parse(vector<string>(argv + 1, argv + argc), cl))
+		service_client::exit_with_usage(1);
+
+	if (cl.command == CLI_COMMAND_STATUS)
+		return print_status(cl.args);
+
+	// no daemon round trip if the status board can answer
+	if (cl.from_board && print_list_from_board())
+		return 0;
+
+	AsyncClient c(IPC_PATH_SERVICE);
+
+	if (!c.is_open())
 	{
-		if (argc != 3)
-			service_client::exit_with_usage(1);
-		bundle << SERVICE_CMD_STOP << name;
+		cerr << "ERROR: Could not open client socket." << endl;
+		exit(1);
 	}
-	else if (command == CLI_COMMAND_RESTART)
+
+	uint32_t id = c.submit(cl.request);
+	if (id == 0)
 	{
-		if (argc != 3)
-			service_client::exit_with_usage(1);
-		bundle << SERVICE_CMD_RESTART << name;
+		cerr << "ERROR: Could not get response." << endl;
+		exit(1);
+	}
+
+	return print_response(cl, c, id);
+}
+
+bool service_client::parse(const std::vector<std::string> & args,
+		command_line & cl)
+{
+	if (args.empty())
+		return false;
+
+	cl.command = args[0];
+	cl.args.assign(args.begin() + 1, args.end());
+	cl.request.clear();
+	cl.timeout = CLI_TIMEOUT_QUERY;
+	cl.bulk = false;
+	cl.batch = false;
+	cl.from_board = false;
+
+	const vector<string> & argv = cl.args;
+	const string & command = cl.command;
+
+	if (command == CLI_COMMAND_START || command == CLI_COMMAND_STOP
+			|| command == CLI_COMMAND_RESTART)
+	{
+		if (argv.empty())
+			return false;
+
+		if (command == CLI_COMMAND_START)
+			cl.request << SERVICE_CMD_START;
+		else if (command == CLI_COMMAND_STOP)
+			cl.request << SERVICE_CMD_STOP;
+		else
+			cl.request << SERVICE_CMD_RESTART;
+
+		// bulk request even for a single service, daemon resolves dependencies
+		int jobs = 0;
+		vector<string> selectors;
+
+		for (size_t i = 0; i < argv.size(); ++i)
+		{
+			if (argv[i] == CLI_OPTION_JOBS && i + 1 < argv.size())
+				jobs = ::atoi(argv[++i].c_str());
+			else if (argv[i] == CLI_OPTION_ALL)
+				selectors.push_back("*");
+			else
+				selectors.push_back(argv[i]);
+		}
+
+		if (selectors.empty() || jobs < 0)
+			return false;
+
+		cl.bulk = true;
+		cl.timeout = CLI_TIMEOUT_LIFECYCLE;
+		cl.request << jobs;
+		for (size_t i = 0; i < selectors.size(); ++i)
+			cl.request << selectors[i];
 	}
 	else if (command == CLI_COMMAND_STATUS)
 	{
-		if (argc != 3)
-			service_client::exit_with_usage(1);
-		bundle << SERVICE_CMD_STATUS << name;
+		// answered by print_status()
+		if (argv.empty())
+			return false;
 	}
 	else if (command == CLI_COMMAND_SHOW)
 	{
-		if (argc != 3)
-			service_client::exit_with_usage(1);
-		bundle << SERVICE_CMD_SHOW << name;
+		if (argv.empty())
+			return false;
+
+		// several services in one request: [count, (element count, command, name)...]
+		cl.batch = (argv.size() > 1);
+		if (cl.batch)
+		{
+			cl.request << SERVICE_CMD_BATCH << (int) argv.size();
+			for (size_t i = 0; i < argv.size(); ++i)
+				cl.request << 2 << SERVICE_CMD_SHOW << argv[i];
+		}
+		else
+			cl.request << SERVICE_CMD_SHOW << argv[0];
 	}
 	else if (command == CLI_COMMAND_LIST)
 	{
-		if (argc == 3 && ::strcmp(argv[2], "-v") == 0)
-			verbose = true;
-		else if (argc != 2)
-			service_client::exit_with_usage(1);
+		string cursor;
+		int page_size = 0;
+		bool verbose = false;
+
+		// plain list needs name, state and pid only
+		int fields = service_t::F_NAME | service_t::F_STATE | service_t::F_PID;
+
+		for (size_t i = 0; i < argv.size(); ++i)
+		{
+			if (argv[i] == "-v")
+				verbose = true;
+			else if (argv[i] == CLI_OPTION_FIELDS && i + 1 < argv.size())
+				fields = service_t::parse_fields(argv[++i]);
+			else if (argv[i] == CLI_OPTION_CURSOR && i + 1 < argv.size())
+				cursor = argv[++i];
+			else if (argv[i] == CLI_OPTION_LIMIT && i + 1 < argv.size())
+				page_size = ::atoi(argv[++i].c_str());
+			else
+				return false;
+		}
+
+		if (fields < 0 || page_size < 0)
+			return false;
+
+		// full service records
+		if (verbose)
+			fields = 0;
 
-		bundle << SERVICE_CMD_LIST;
+		cl.from_board = (fields == (service_t::F_NAME | service_t::F_STATE
+				| service_t::F_PID) && cursor.empty() && page_size == 0);
+
+		cl.request << SERVICE_CMD_LIST << cursor << page_size << fields;
+	}
+	else if (command == CLI_COMMAND_WATCH)
+	{
+		cl.request << SERVICE_CMD_SUBSCRIBE;
+		for (size_t i = 0; i < argv.size(); ++i)
+			cl.request << argv[i];
 	}
 	else
 	{
-		service_client::exit_with_usage(1);
+		return false;
 	}
 
-	DomainClient c;
+	return true;
+}
 
-	if (!c.is_open())
-	{
-		cerr << "ERROR: Could not open client socket." << endl;
-		exit(1);
-	}
+int service_client::print_response(const command_line & cl, AsyncClient & c,
+		uint32_t request_id)
+{
+	const string & command = cl.command;
+	const string name = cl.args.empty() ? "" : cl.args[0];
+
+	// LIST and WATCH responses are streamed
+	bool streamed = (command == CLI_COMMAND_LIST
+			|| command == CLI_COMMAND_WATCH);
 
 	Bundle response;
-	if (!c.query(IPC_PATH_SERVICE, bundle, response, 5000))
+	if (!c.wait(request_id, response, cl.timeout, !streamed))
 	{
 		cerr << "ERROR: Could not get response." << endl;
-		exit(1);
+		c.cancel(request_id);
+		return 1;
+	}
+
+	bool ok = response.getBool();
+
+	// replies of batched commands: [true, count, (element count, reply...)...]
+	if (cl.batch && ok)
+	{
+		int n = response.getInt();
+		int rc = 0;
+
+		for (int i = 0; i < n; ++i)
+		{
+			Bundle reply;
+			response.getBundle(reply, response.getInt());
+
+			if (!reply.getBool())
+			{
+				string message = "";
+				if (reply.count() > 0
+						&& reply.getNextType() == Bundle::TYPE_STRING)
+					message = reply.getString();
+
+				cerr << "ERROR: " << cl.args[i] << ": " << message << endl;
+				rc = 1;
+				continue;
+			}
+
+			service_t s;
+			reply >> s;
+			cout << "---------------------------------------" << endl << s
+					<< endl;
+		}
+
+		return rc;
 	}
 
-	if (!response.getBool())
+	// per service results
+	if (cl.bulk && response.count() > 0
+			&& response.getNextType() == Bundle::TYPE_INT)
+	{
+		int n = response.getInt();
+
+		const char * done = "started.";
+		if (command == CLI_COMMAND_STOP)
+			done = "stopped.";
+		else if (command == CLI_COMMAND_RESTART)
+			done = "restarted.";
+
+		for (int i = 0; i < n; ++i)
+		{
+			string service = response.getString();
+			bool succeeded = response.getBool();
+			string message = response.getString();
+
+			if (succeeded)
+				cout << service << " is " << done << endl;
+			else
+				cerr << "ERROR: " << service << ": " << message << endl;
+		}
+
+		// dependency chain that determined the duration
+		if (response.count() > 0)
+		{
+			string path = response.getString();
+			if (!path.empty())
+				cout << "critical path: " << path << endl;
+		}
+
+		return ok ? 0 : 1;
+	}
+
+	if (!ok)
 	{
 		string message = "";
 		if (response.count() > 0
@@ -138,7 +495,8 @@ int service_client::process(int argc, char * argv[])
 			message = response.getString();
 
 		cerr << "ERROR: command failed: " << message << endl;
-		exit(1);
+		c.cancel(request_id);
+		return 1;
 	}
 
 	//	response.printElements();
@@ -155,12 +513,6 @@ int service_client::process(int argc, char * argv[])
 	{
 		cout << name << " is restarted." << endl;
 	}
-	else if (command == CLI_COMMAND_STATUS)
-	{
-		bool is_running = response.getBool();
-		cout << name << " is " << (is_running ? "running." : "stopped.")
-				<< endl;
-	}
 	else if (command == CLI_COMMAND_SHOW)
 	{
 		service_t s;
@@ -169,29 +521,217 @@ int service_client::process(int argc, char * argv[])
 	}
 	else if (command == CLI_COMMAND_LIST)
 	{
-		service_t s;
-		bool b;
-		while (response.count() > 0)
+		const int plain = service_t::F_NAME | service_t::F_STATE
+				| service_t::F_PID;
+		string next_page;
+
+		// response is streamed in chunks: [true, more, next page cursor, fields, record...]
+		while (true)
 		{
-			response >> s;
+			bool more = response.getBool();
+			next_page = response.getString();
+			int record_fields = response.getInt();
 
-			if (verbose)
+			while (response.count() > 0)
 			{
-				cout << "---------------------------------------" << endl << s
-						<< endl;
+				service_t s;
+
+				if (record_fields == 0)
+					response >> s;
+				else
+					s.read_fields(response, record_fields);
+
+				if (record_fields == 0)
+				{
+					cout << "---------------------------------------" << endl
+							<< s << endl;
+				}
+				else if (record_fields == plain)
+				{
+					cout << s.cfg.name << ": ";
+					if (s.is_running())
+						cout << service_t::state_name(s.state) << ", process "
+								<< s.pid;
+					else
+						cout << service_t::state_name(s.state) << ".";
+					cout << endl;
+				}
+				else
+				{
+					cout << s.cfg.name << ": " << s.fields_to_string(record_fields)
+							<< endl;
+				}
 			}
-			else
+
+			if (!more)
+				break;
+
+			response.clear();
+			if (!c.wait(request_id, response, cl.timeout, false)
+					|| !response.getBool())
 			{
-				b = s.is_running();
-				cout << s.cfg.name << ": ";
-				if (b)
-					cout << "running, process " << s.pid;
-				else
-					cout << "stopped.";
-				cout << endl;
+				cerr << "ERROR: Could not get response." << endl;
+				c.cancel(request_id);
+				return 1;
+			}
+		}
+
+		c.cancel(request_id);
+
+		// page limit reached
+		if (!next_page.empty())
+			cerr << "more services: " << __progname << " " << CLI_COMMAND_LIST
+					<< " " << CLI_OPTION_CURSOR << " " << next_page << endl;
+	}
+	else if (command == CLI_COMMAND_WATCH)
+	{
+		int dropped = 0;
+
+		// events until the daemon goes away: [true, dropped, time, event, name, pid, value]
+		while (true)
+		{
+			response.clear();
+			if (!c.wait(request_id, response, LLONG_MAX, false))
+				break;
+
+			if (!response.getBool())
+				continue;
+
+			int total_dropped = response.getInt();
+			time_t t = response.getInt();
+			string event = response.getString();
+			string service = response.getString();
+			int pid = response.getInt();
+			int value = response.getInt();
+
+			if (total_dropped > dropped)
+			{
+				cerr << "WARNING: " << total_dropped - dropped
+						<< " events dropped." << endl;
+				dropped = total_dropped;
 			}
+
+			char stamp[32];
+			::strftime(stamp, sizeof(stamp), "%F %T", ::localtime(&t));
+
+			cout << stamp << " " << service << " " << event;
+			if (pid > 0)
+				cout << ", process " << pid;
+			if (event == SERVICE_EVENT_EXITED)
+				cout << ", code " << value;
+			else if (event == SERVICE_EVENT_KILLED)
+				cout << ", signal " << value;
+			else if (event == SERVICE_EVENT_RESPAWN)
+				cout << " in " << value << " ms";
+			cout << endl;
 		}
+
+		cerr << "ERROR: Connection to the daemon is lost." << endl;
+		return 1;
 	}
 
 	return 0;
 }
+
+int service_client::print_pending(AsyncClient & c,
+		std::deque<std::pair<command_line, uint32_t> > & pending,
+		const size_t keep)
+{
+	int rc = 0;
+
+	while (pending.size() > keep)
+	{
+		if (print_response(pending.front().first, c, pending.front().second)
+				!= 0)
+			rc = 1;
+
+		pending.pop_front();
+	}
+
+	return rc;
+}
+
+int service_client::run_session(std::istream & in)
+{
+	AsyncClient c(IPC_PATH_SERVICE);
+
+	if (!c.is_open())
+	{
+		cerr << "ERROR: Could not open client socket." << endl;
+		return 1;
+	}
+
+	// submitted requests in input order, printed as their turn comes
+	deque<pair<command_line, uint32_t> > pending;
+	// a start/stop/restart is pending
+	bool lifecycle = false;
+	int rc = 0;
+
+	string line;
+	int line_number = 0;
+
+	while (std::getline(in, line))
+	{
+		++line_number;
+
+		istringstream iss(line);
+		vector<string> args;
+		string arg;
+
+		while (iss >> arg)
+			args.push_back(arg);
+
+		// empty line or comment
+		if (args.empty() || args[0][0] == '#')
+			continue;
+
+		command_line cl;
+		if (!parse(args, cl) || cl.command == CLI_COMMAND_WATCH)
+		{
+			cerr << "ERROR: line " << line_number << ": invalid command: "
+					<< line << endl;
+			rc = 1;
+			continue;
+		}
+
+		// reads see the effect of preceding lifecycle commands, local reads
+		// are printed after preceding output
+		bool local = (cl.command == CLI_COMMAND_STATUS || cl.from_board);
+		if (local || (lifecycle && !cl.bulk))
+		{
+			if (print_pending(c, pending, 0) != 0)
+				rc = 1;
+			lifecycle = false;
+		}
+
+		if (cl.command == CLI_COMMAND_STATUS)
+		{
+			if (print_status(cl.args) != 0)
+				rc = 1;
+			continue;
+		}
+
+		if (cl.from_board && print_list_from_board())
+			continue;
+
+		if (print_pending(c, pending, CLI_SESSION_WINDOW - 1) != 0)
+			rc = 1;
+
+		uint32_t id = c.submit(cl.request);
+		if (id == 0)
+		{
+			cerr << "ERROR: line " << line_number
+					<< ": Could not send request." << endl;
+			rc = 1;
+			break;
+		}
+
+		pending.push_back(make_pair(cl, id));
+		lifecycle = lifecycle || cl.bulk;
+	}
+
+	if (print_pending(c, pending, 0) != 0)
+		rc = 1;
+
+	return rc;
+}
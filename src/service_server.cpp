@@ -1,25 +1,78 @@
 #include "service_server.h"
 
+#include <algorithm>
 #include <cerrno>
+#include <climits>
 #include <cstring>
 #include <sstream>
 
+#include <fnmatch.h>
+#include <poll.h>
 #include <signal.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #include "fileutils.h"
 #include "ServiceMessages.h"
 #include "stringutils.h"
+#include "Timer.h"
 
 #define SERVICE_LIST_SEPERATOR					":"
 
+/** @brief time to wait for exit after SIGKILL in milliseconds */
+#define SERVICE_KILL_TIMEOUT					1000
+
+/** @brief default max parallel operations of a bulk START/STOP/RESTART */
+#define SERVICE_BULK_JOBS						16
+
+/** @brief services per LIST response chunk */
+#define SERVICE_LIST_CHUNK						64
+
+/** @brief max queued response bytes per client before a stream waits */
+#define SERVICE_STREAM_WINDOW					(256 * 1024)
+
+/** @brief max lifecycle events queued per subscriber, further events are dropped */
+#define SERVICE_WATCH_QUEUE						1024
+
+/** @brief max queued event bytes per subscriber connection */
+#define SERVICE_WATCH_WINDOW					(64 * 1024)
+
+/** @brief max events handled per epoll_wait() call */
+#define REACTOR_MAX_EVENTS						32
+
 using namespace std;
 
 const std::string service_server::dirpath_service = DIRPATH_SERVICES;
 
+/**
+ * @brief Check whether the process of a pidfd has exited
+ *
+ * An event of an epoll batch may belong to a descriptor closed by an
+ * earlier event and reused for a new process meanwhile.
+ */
+static bool process_exited(int pidfd)
+{
+	struct pollfd pfd;
+
+	pfd.fd = pidfd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return ::poll(&pfd, 1, 0) > 0;
+}
+
 service_server::service_server() :
-		run_state(RS_INIT)
+		epoll_fd(-1), sigchld_fd(-1), config_watch_fd(-1),
+		dependencies_loaded(false), next_request_id(1)
 {
+	config_dir_mtime.tv_sec = 0;
+	config_dir_mtime.tv_nsec = 0;
+
 #ifdef _DEBUG
 	debug.setEnabled(false);
 	debug.setPrintLevel(Debug::INFO);
@@ -37,487 +90,1874 @@ void service_server::run()
 {
 	debug.i("SERVICE DAEMON             pid = %d", getpid());
 
-	while (true)
-	{
-		switch (run_state)
-		{
-		case RS_INIT:
-			load_service_list();
+	load_service_list();
 
-			run_state = RS_SERVICE_CHECK;
-			break;
+	check_services();
 
-		case RS_SERVICE_CHECK:
-		{
-			vector<map<string, service_t>::iterator> erase_list;
-			for (map<string, service_t>::iterator it = running_services.begin();
-					it != running_services.end(); ++it)
-			{
-				service_t & s = it->second;
-				if (!s.is_running() && s.cfg.respawn
-						&& !s.respawn_timer_enabled)
-				{
-					// set up respawn timer if limit not exceeded
-					if (s.respawn_count < s.cfg.respawn_limit)
-					{
-						s.respawn_timer.set(s.cfg.respawn_interval * 1000);
-						s.respawn_timer_enabled = true;
-					}
-					else
-					{
-//							running_services.erase(it);
-						erase_list.push_back(it);
-						continue;
-					}
-				}
-				// erase if not running and respawn disabled
-				else if (!s.is_running() && !s.cfg.respawn)
-				{
-//						running_services.erase(it);
-					erase_list.push_back(it);
-					continue;
-				}
-			} // end-of-for services
+	sync_status();
 
-			// erase services
-			if (!erase_list.empty())
-			{
-				while (!erase_list.empty())
-				{
-					running_services.erase(erase_list[erase_list.size() - 1]);
-					erase_list.pop_back();
-				}
+	const map<string, config_t> & configs = load_dependencies();
+	set<string> names;
+	for (map<string, config_t>::const_iterator it = configs.begin();
+			it != configs.end(); ++it)
+		names.insert(it->first);
 
-				save_service_list();
-			}
+	string error;
+	if (!check_dependencies(configs, names, error))
+		debug.e("invalid service dependencies, " + error);
 
-			run_state = RS_SERVICE_RESPAWN;
-			break;
-		}
+	struct epoll_event events[REACTOR_MAX_EVENTS];
 
-		case RS_SERVICE_RESPAWN:
+	while (true)
+	{
+		// block until an event source is ready
+		int n = ::epoll_wait(epoll_fd, events, REACTOR_MAX_EVENTS, -1);
+		if (n < 0)
 		{
-			config_t temp;
-			for (map<string, service_t>::iterator it = running_services.begin();
-					it != running_services.end(); ++it)
-			{
-				service_t & s = it->second;
-
-				if (s.respawn_timer_enabled && s.respawn_timer.isTimeout())
-				{
-					debug.w("respawning service " + s.cfg.name);
-
-					// update with new config data
-					if (!temp.import(get_config_filepath(s.cfg.name)))
-					{
-						debug.e(
-								"Could not respawn service " + s.cfg.name
-										+ ": import() failed");
-					}
-					else
-					{
-						s.cfg = temp;
-
-						if (!s.start())
-							debug.e("Could not respawn service " + s.cfg.name);
-						else
-						{
-							save_service_list();
-						}
-					}
-					++s.respawn_count;
-					s.respawn_timer_enabled = false;
-				}
-			} // end-of-for services
-
-			run_state = RS_HANDLE_COMMAND;
-			break;
+			if (errno != EINTR)
+				debug.e("epoll_wait() failed: %s", strerror(errno));
+			continue;
 		}
-		case RS_HANDLE_COMMAND:
-			while (domain_server.recvfrom(client_address, bundle))
-			{
-				string command = bundle.getString();
 
-				debug.i("Message text : " + command);
-				debug.i("\t" + bundle.toString());
-
-				// search for command
-				if (command_handlers.find(command) == command_handlers.end())
-				{
-					debug.write(Debug::WARNING, "unknown command: " + command);
-					domain_server.sendto(client_address,
-							Bundle() << false << "unknown command");
-					continue;
-				}
+		for (int i = 0; i < n; ++i)
+		{
+			map<int, event_handler>::iterator it = event_handlers.find(
+					events[i].data.fd);
 
-				try
-				{
-					// process message
-					(this->*command_handlers[command])(bundle);
-				} catch (exception & e)
-				{
-					debug.e(e.what());
-				}
-			}
+			// fd may be unwatched by a previous handler
+			if (it == event_handlers.end())
+				continue;
 
-			run_state = RS_SERVICE_CHECK;
-			break;
+			(this->*(it->second))(it->first, events[i].events);
 		}
-
-		usleep(10000);
 	} // end-of-while true
 }
 
-std::string service_server::get_config_filepath(
-		const std::string & service_name)
+void service_server::check_services()
 {
-	return dirpath_service + "/" + service_name + FILE_EXTENSION_CONFIG;
+	bool changed = false;
+
+	for (map<string, service_t>::iterator it = running_services.begin();
+			it != running_services.end();)
+	{
+		// advance before check, service may be erased
+		map<string, service_t>::iterator cur = it++;
+
+		if (check_service(cur))
+			changed = true;
+	} // end-of-for services
+
+	if (changed)
+		save_service_list();
 }
 
-void service_server::load_service_list()
+bool service_server::check_service(std::map<std::string, service_t>::iterator it)
 {
-	vector<string> lines, parts;
+	service_t & s = it->second;
 
-	fileutils::load_file(filepath_service_list, lines);
-	for (size_t i = 0; i < lines.size(); ++i)
+	// running or waiting for respawn
+	if (s.is_running() || s.respawn_timer != 0)
+		return false;
+
+	// set up respawn timer if limit not exceeded
+	if (s.cfg.respawn && s.respawn_count < s.cfg.respawn_limit)
 	{
-		stringutils::split(lines[i], SERVICE_LIST_SEPERATOR, parts);
+		s.respawn_timer = timers.add(s.cfg.respawn_interval * 1000,
+				TT_RESPAWN, s.cfg.name);
+		publish(SERVICE_EVENT_RESPAWN, s.cfg.name, -1,
+				s.cfg.respawn_interval * 1000);
+		return false;
+	}
 
-		if (parts.size() == 2)
-		{
-			pid_t pid = ::atoi(parts[1].c_str());
+	// erase if not running and respawn disabled (or limit exceeded)
+	retire(it);
 
-			service_t s;
+	return true;
+}
 
-			// if running
-			if (pid > 0 && ::kill(pid, 0) == 0)
-			{
-				if (s.import(get_config_filepath(parts[0])))
-				{
-					debug.w("%s service is already running... pid = %d",
-							s.cfg.name.c_str(), pid);
-					s.pid = pid;
-					running_services[s.cfg.name] = s;
-				}
-			}
-		}
-	} // end-of-for lines
+void service_server::retire(std::map<std::string, service_t>::iterator it)
+{
+	timers.cancel(it->second.respawn_timer);
+	it->second.respawn_timer = 0;
+	timers.cancel(it->second.stop_timer);
+	it->second.stop_timer = 0;
+	it->second.restart_pending = false;
+
+	publish(SERVICE_EVENT_STOPPED, it->first, -1);
+
+	// keep last run (exit status etc.) for SHOW and LIST
+	stopped_services[it->first] = it->second;
+
+	running_services.erase(it);
 }
 
-void service_server::save_service_list()
+void service_server::respawn_service(const std::string & name,
+		TimerWheel::timer_id id)
 {
-	stringstream ss;
-	for (map<string, service_t>::const_iterator it = running_services.begin();
-			it != running_services.end(); ++it)
-	{
-		const service_t & s = it->second;
-		if (s.is_running())
-		{
-			ss << s.cfg.name << SERVICE_LIST_SEPERATOR << s.pid << endl;
-		}
-	}
+	map<string, service_t>::iterator it = running_services.find(name);
 
-	if (fileutils::save_file(filepath_service_list, ss.str(), 777))
+	// ignore stale timers
+	if (it == running_services.end() || it->second.respawn_timer != id)
+		return;
+
+	service_t & s = it->second;
+	config_t temp;
+
+	s.respawn_timer = 0;
+
+	debug.w("respawning service " + s.cfg.name);
+
+	// update with new config data
+	if (!temp.import(get_config_filepath(s.cfg.name)))
 	{
-		debug.i("service list file updated.");
+		debug.e("Could not respawn service " + s.cfg.name + ": import() failed");
 	}
 	else
 	{
-		debug.e("Could not save service list file.");
+		s.cfg = temp;
+
+		if (!s.start(scripts))
+		{
+			debug.e("Could not respawn service " + s.cfg.name);
+			publish(SERVICE_EVENT_FAILED, s.cfg.name, -1);
+		}
+		else
+		{
+			supervise(s);
+			save_service_list();
+			publish(SERVICE_EVENT_STARTED, s.cfg.name, s.pid);
+		}
 	}
+	++s.respawn_count;
+	update_status(name);
+
+	// schedule next try if start failed
+	if (check_service(it))
+		save_service_list();
 }
 
-void service_server::handle_START(Bundle & bundle)
+bool service_server::watch(int fd, uint32_t events, event_handler handler)
 {
-	if (bundle.count() != 1)
+	struct epoll_event ev;
+
+	::memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.fd = fd;
+
+	if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "invalid argument.");
-		return;
+		debug.e("epoll_ctl(ADD, %d) failed: %s", fd, strerror(errno));
+		return false;
 	}
 
-	string name = bundle.getString();
+	event_handlers[fd] = handler;
 
-	map<string, service_t>::iterator it = running_services.find(name);
+	return true;
+}
 
-	// if already running
-	if (it != running_services.end() && it->second.is_running())
-	{
-		domain_server.sendto(client_address, Bundle() << true);
+void service_server::unwatch(int fd)
+{
+	if (event_handlers.erase(fd) == 0)
 		return;
-	}
 
-	string filepath_cfg = get_config_filepath(name);
-	if (!fileutils::exist(filepath_cfg))
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "config file not found.");
-		return;
-	}
+	if (::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0)
+		debug.e("epoll_ctl(DEL, %d) failed: %s", fd, strerror(errno));
+}
 
-	service_t s;
-	if (!s.import(filepath_cfg))
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "error in config file.");
-		return;
-	}
+void service_server::supervise(service_t & s)
+{
+	if (s.pid > 0)
+		pid_services[s.pid] = s.cfg.name;
 
-	if (!s.start())
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "start() failed.");
+	if (s.pidfd < 0)
 		return;
-	}
 
-	// save running services
-	running_services[name] = s;
-	save_service_list();
+	if (watch(s.pidfd, EPOLLIN, &service_server::on_pidfd_event))
+		pidfd_services[s.pidfd] = s.cfg.name;
+}
+
+void service_server::unsupervise(service_t & s)
+{
+	map<pid_t, string>::iterator it = pid_services.find(s.pid);
+	if (it != pid_services.end() && it->second == s.cfg.name)
+		pid_services.erase(it);
+
+	if (s.pidfd < 0)
+		return;
 
-	domain_server.sendto(client_address, Bundle() << true);
+	unwatch(s.pidfd);
+	pidfd_services.erase(s.pidfd);
 }
 
-void service_server::handle_STOP(Bundle & bundle)
+void service_server::on_ipc_event(int, uint32_t)
 {
-	if (bundle.count() != 1)
+	while (domain_server.recvfrom(client_address, bundle))
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "invalid argument.");
-		return;
+		// a request without a command is an unknown command
+		string command;
+		if (bundle.count() > 0 && bundle.getNextType() == Bundle::TYPE_STRING)
+			command = bundle.getString();
+
+		debug.i("Message text : " + command);
+		if (debug.getPrintLevel() >= Debug::INFO)
+			debug.i("\t" + bundle.toString());
+
+		// search for command
+		if (command_handlers.find(command) == command_handlers.end())
+		{
+			debug.write(Debug::WARNING, "unknown command: " + command);
+			send(client_address,
+					Bundle() << false << "unknown command");
+			continue;
+		}
+
+		try
+		{
+			// process message
+			(this->*command_handlers[command])(bundle);
+		} catch (exception & e)
+		{
+			debug.e(e.what());
+		}
 	}
 
-	const string name = bundle.getString();
+	// connections may be writable again
+	continue_streams();
+	flush_events();
+}
 
-	string filepath_cfg = get_config_filepath(name);
-	bool found = fileutils::exist(filepath_cfg, fileutils::FT_REG);
+void service_server::on_timer_event(int, uint32_t)
+{
+	vector<TimerWheel::Expired> expired;
 
-	map<string, service_t>::iterator it = running_services.find(name);
+	timers.expire(expired);
 
-	// if already stopped
-	if (it == running_services.end() && found)
+	for (size_t i = 0; i < expired.size(); ++i)
 	{
-		domain_server.sendto(client_address, Bundle() << true);
-		return;
+		switch (expired[i].type)
+		{
+		case TT_RESPAWN:
+			respawn_service(expired[i].key, expired[i].id);
+			break;
+
+		case TT_STOP_DEADLINE:
+			stop_deadline(expired[i].key, expired[i].id);
+			break;
+		}
 	}
+}
 
-	if (!found)
+void service_server::on_pidfd_event(int fd, uint32_t)
+{
+	map<int, string>::iterator it = pidfd_services.find(fd);
+	if (it == pidfd_services.end())
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "config file not found.");
+		unwatch(fd);
 		return;
 	}
 
-	// if it is stopped
-	if (!it->second.is_running())
-	{
-		domain_server.sendto(client_address, Bundle() << true);
-	}
-	else if (!it->second.stop())
+	map<string, service_t>::iterator sit = running_services.find(it->second);
+	if (sit == running_services.end())
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "stop() failed.");
+		unwatch(fd);
+		pidfd_services.erase(it);
+		::close(fd);
 		return;
 	}
 
-	// save running services
-	running_services.erase(it);
-	save_service_list();
+	// stale event of a reused descriptor
+	if (!process_exited(fd))
+		return;
 
-	domain_server.sendto(client_address, Bundle() << true);
+	// collect exit status if SIGCHLD is not handled yet
+	sit->second.reap();
+
+	service_exited(sit);
 }
 
-void service_server::handle_RESTART(Bundle & bundle)
+void service_server::on_onstop_event(int fd, uint32_t)
 {
-	if (bundle.count() != 1)
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "invalid argument.");
+	// stale event of a reused descriptor
+	if (!process_exited(fd))
 		return;
-	}
-
-	string name = bundle.getString();
 
-	map<string, service_t>::iterator it = running_services.find(name);
+	unwatch(fd);
 
-	// stop if running
-	if (it != running_services.end())
+	map<int, string>::iterator it = onstop_services.find(fd);
+	if (it == onstop_services.end())
 	{
-		if (!it->second.stop())
-		{
-			domain_server.sendto(client_address,
-					Bundle() << false << "stop() failed.");
-			return;
-		}
+		::close(fd);
+		return;
 	}
 
-	// start
+	string name = it->second;
+	onstop_services.erase(it);
 
-	string filepath_cfg = get_config_filepath(name);
-	if (!fileutils::exist(filepath_cfg))
+	map<string, service_t>::iterator sit = running_services.find(name);
+	if (sit == running_services.end() || sit->second.onstop_pidfd != fd)
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "config file not found.");
+		::close(fd);
 		return;
 	}
 
-	service_t s;
-	if (!s.import(filepath_cfg))
+	sit->second.onstop_exited();
 
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "error in config file.");
-		return;
-	}
+	stop_finished(sit);
+}
 
-	if (!s.start())
+void service_server::on_sigchld_event(int fd, uint32_t)
+{
+	struct signalfd_siginfo si;
+
+	// drain pending signals, siginfo is not used as signals are merged
+	while (::read(fd, &si, sizeof(si)) == sizeof(si))
+		;
+
+	int status;
+	struct rusage ru;
+	pid_t pid;
+
+	// reap all exited children, orphans of services included
+	while ((pid = ::wait4(-1, &status, WNOHANG, &ru)) > 0)
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "start() failed.");
-		return;
-	}
+		map<pid_t, string>::iterator p = pid_services.find(pid);
+		if (p == pid_services.end())
+			continue;
 
-	// save running services (pid changed)
-	running_services[name] = s;
-	save_service_list();
+		map<string, service_t>::iterator it = running_services.find(p->second);
+		if (it == running_services.end() || it->second.pid != pid
+				|| !it->second.is_running())
+		{
+			pid_services.erase(p);
+			continue;
+		}
 
-	domain_server.sendto(client_address, Bundle() << true);
+		it->second.set_exit_status(status, &ru);
+		service_exited(it);
+	}
 }
 
-void service_server::handle_STATUS(Bundle & bundle)
+void service_server::on_config_dir_event(int fd, uint32_t)
 {
-	if (bundle.count() != 1)
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "invalid argument.");
-		return;
-	}
+	char buf[4096];
 
-	string name = bundle.getString();
+	// drain events, the directory is re-read once
+	while (::read(fd, buf, sizeof(buf)) > 0)
+		;
 
-	map<string, service_t>::iterator it = running_services.find(name);
+	dependencies_loaded = false;
 
-	domain_server.sendto(client_address,
-			Bundle() << true
-					<< (it != running_services.end() && it->second.is_running()));
+	sync_status();
 }
 
-void service_server::handle_SHOW(Bundle & bundle)
+void service_server::service_exited(
+		std::map<std::string, service_t>::iterator it)
 {
-	if (bundle.count() != 1)
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "invalid argument.");
-		return;
-	}
+	service_t & s = it->second;
+	bool stopping = (s.state == service_t::ST_STOPPING
+			|| s.state == service_t::ST_KILLING);
 
-	string name = bundle.getString();
-	Bundle response;
+	unsupervise(s);
 
-	map<string, service_t>::iterator it = running_services.find(name);
-	if (it != running_services.end())
+	if (s.exit_signal != 0)
 	{
-		domain_server.sendto(client_address, Bundle() << true// command response
-				<< it->second);	// information
-		return;
+		debug.w("service %s killed by signal %d, pid = %d",
+				s.cfg.name.c_str(), s.exit_signal, s.pid);
+		publish(SERVICE_EVENT_KILLED, s.cfg.name, s.pid, s.exit_signal);
 	}
-
-	string filepath_cfg = get_config_filepath(name);
-	if (!fileutils::exist(filepath_cfg))
+	else
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "config file not found.");
-		return;
+		debug.w("service %s exited with code %d, pid = %d",
+				s.cfg.name.c_str(), s.exit_code, s.pid);
+		publish(SERVICE_EVENT_EXITED, s.cfg.name, s.pid, s.exit_code);
 	}
 
-	service_t s;
-	if (!s.import(filepath_cfg))
+	s.on_exit();
+
+	// requested by STOP/RESTART, do not respawn
+	if (stopping)
 	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "error in config file.");
+		stop_completed(it);
 		return;
 	}
 
-	domain_server.sendto(client_address, Bundle() << true	// command response
-			<< s);	// information
+	if (check_service(it))
+		save_service_list();
 }
 
-void service_server::handle_LIST(Bundle & bundle)
+bool service_server::begin_stop(std::map<std::string, service_t>::iterator it)
 {
-	// we used map here to order services by their name
-	map<string, service_t> all_services;
-
-	if (!get_all_services(all_services))
-	{
-		domain_server.sendto(client_address,
-				Bundle() << false << "could not read services.");
-		return;
-	}
+	service_t & s = it->second;
 
-	Bundle response;
+	if (!s.stop())
+		return false;
 
-	response << true;
+	s.stop_timer = timers.add(s.cfg.stop_timeout, TT_STOP_DEADLINE, s.cfg.name);
 
-	for (map<string, service_t>::const_iterator it = all_services.begin();
-			it != all_services.end(); ++it)
-		response << it->second;
+	publish(SERVICE_EVENT_STOPPING, s.cfg.name, s.pid);
 
-	domain_server.sendto(client_address, response);
+	return true;
 }
 
-bool service_server::get_all_services(
-		std::map<string, service_t> & all_services)
+void service_server::stop_deadline(const std::string & name,
+		TimerWheel::timer_id id)
 {
-	for (map<string, service_t>::const_iterator it = running_services.begin();
-			it != running_services.end(); ++it)
-	{
-		all_services[it->first] = it->second;
-	}
+	map<string, service_t>::iterator it = running_services.find(name);
 
-	vector<string> filenames;
-	service_t temp;
+	// ignore stale timers
+	if (it == running_services.end() || it->second.stop_timer != id)
+		return;
 
-	fileutils::read_dir(dirpath_service, filenames);
+	service_t & s = it->second;
+	s.stop_timer = 0;
+
+	if (s.state == service_t::ST_STOPPING)
+	{
+		debug.w("service %s did not stop in %d ms, killing",
+				s.cfg.name.c_str(), s.cfg.stop_timeout);
+
+		if (s.kill())
+		{
+			update_status(name);
+			s.stop_timer = timers.add(SERVICE_KILL_TIMEOUT, TT_STOP_DEADLINE,
+					name);
+			return;
+		}
+	}
+
+	// SIGKILL did not take effect, exit is still handled when it comes
+	debug.e("Could not stop service " + name);
+
+	s.restart_pending = false;
+	complete(name, false, "stop() failed.");
+}
+
+void service_server::stop_completed(
+		std::map<std::string, service_t>::iterator it)
+{
+	service_t & s = it->second;
+	const string name = it->first;
+
+	timers.cancel(s.stop_timer);
+	s.stop_timer = 0;
+
+	s.pid = -1;
+	s.on_post_stop();
+
+	// restart starts the new run after onstop
+	if (s.restart_pending)
+	{
+		s.state = service_t::ST_STARTING;
+		publish(SERVICE_EVENT_STARTING, name, -1);
+	}
+
+	// onstop may take long, the loop keeps serving while it runs
+	if (s.run_onstop())
+	{
+		if (watch(s.onstop_pidfd, EPOLLIN, &service_server::on_onstop_event))
+		{
+			onstop_services[s.onstop_pidfd] = name;
+			return;
+		}
+
+		// not waited, reaped by the SIGCHLD handler
+		s.onstop_exited();
+	}
+
+	stop_finished(it);
+}
+
+void service_server::stop_finished(
+		std::map<std::string, service_t>::iterator it)
+{
+	service_t & s = it->second;
+	const string name = it->first;
+
+	if (!s.restart_pending)
+	{
+		retire(it);
+		save_service_list();
+
+		complete(name, true);
+		return;
+	}
+
+	// restart
+	string error;
+	if (!start_service(name, error))
+	{
+		s.state = service_t::ST_STOPPED;
+		retire(it);
+		save_service_list();
+
+		complete(name, false, error);
+		return;
+	}
+
+	complete(name, true);
+}
+
+bool service_server::start_service(const std::string & name, std::string & error)
+{
+	string filepath_cfg = get_config_filepath(name);
+	if (!fileutils::exist(filepath_cfg))
+	{
+		error = "config file not found.";
+		return false;
+	}
+
+	service_t s;
+	if (!s.import(filepath_cfg))
+	{
+		error = "error in config file.";
+		return false;
+	}
+
+	if (!s.start(scripts))
+	{
+		error = "start() failed.";
+		publish(SERVICE_EVENT_FAILED, name, -1);
+		return false;
+	}
+
+	map<string, service_t>::iterator it = running_services.find(name);
+
+	// replace entry waiting for respawn
+	if (it != running_services.end())
+		timers.cancel(it->second.respawn_timer);
+
+	// save running services
+	running_services[name] = s;
+	supervise(running_services[name]);
+	stopped_services.erase(name);
+	save_service_list();
+
+	publish(SERVICE_EVENT_STARTED, name, s.pid);
+
+	return true;
+}
+
+void service_server::wait(const std::string & name, int request_id)
+{
+	waiter w;
+	w.client = client_address;
+	w.request_id = request_id;
+
+	waiters[name].push_back(w);
+}
+
+void service_server::complete(const std::string & name, bool ok,
+		const std::string & error)
+{
+	map<string, vector<waiter> >::iterator it = waiters.find(name);
+	if (it != waiters.end())
+	{
+		// detach first, a reply may not be sent twice
+		vector<waiter> clients;
+		clients.swap(it->second);
+		waiters.erase(it);
+
+		for (size_t i = 0; i < clients.size(); ++i)
+			reply_waiter(clients[i], name, ok, error);
+	}
+
+	run_queued(name);
+}
+
+void service_server::reply_waiter(const waiter & w, const std::string & name,
+		bool ok, const std::string & error)
+{
+	if (w.request_id == 0)
+	{
+		Bundle response;
+		response << ok;
+		if (!ok)
+			response << error;
+
+		send(w.client, response);
+		return;
+	}
+
+	map<int, bulk_request>::iterator r = bulk_requests.find(w.request_id);
+	if (r == bulk_requests.end())
+		return;
+
+	r->second.in_flight.erase(name);
+	bulk_done(r->second, name, ok, error);
+
+	bulk_step(w.request_id);
+}
+
+service_server::OperationResult service_server::begin_operation(
+		const std::string & name, operation op, std::string & error,
+		int request_id)
+{
+	// keep order behind the operation in progress
+	if (busy(name) || queued_operations.count(name) > 0)
+	{
+		pending_operation p;
+		p.op = op;
+		p.w.client = client_address;
+		p.w.request_id = request_id;
+
+		queued_operations[name].push_back(p);
+		return OP_PENDING;
+	}
+
+	OperationResult r = (this->*op)(name, error);
+	if (r == OP_PENDING)
+		wait(name, request_id);
+
+	return r;
+}
+
+bool service_server::busy(const std::string & name) const
+{
+	if (waiters.count(name) > 0)
+		return true;
+
+	map<string, service_t>::const_iterator it = running_services.find(name);
+	return it != running_services.end() && it->second.onstop_pid > 0;
+}
+
+void service_server::run_queued(const std::string & name)
+{
+	while (!busy(name))
+	{
+		map<string, deque<pending_operation> >::iterator it =
+				queued_operations.find(name);
+		if (it == queued_operations.end())
+			return;
+
+		pending_operation p = it->second.front();
+		it->second.pop_front();
+		if (it->second.empty())
+			queued_operations.erase(it);
+
+		string error;
+		OperationResult r = (this->*p.op)(name, error);
+
+		if (r == OP_PENDING)
+			waiters[name].push_back(p.w);
+		else
+			reply_waiter(p.w, name, r == OP_OK, error);
+	}
+}
+
+std::string service_server::get_config_filepath(
+		const std::string & service_name)
+{
+	return dirpath_service + "/" + service_name + FILE_EXTENSION_CONFIG;
+}
+
+void service_server::load_service_list()
+{
+	vector<string> lines, parts;
+
+	fileutils::load_file(filepath_service_list, lines);
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+		stringutils::split(lines[i], SERVICE_LIST_SEPERATOR, parts);
+
+		if (parts.size() == 2)
+		{
+			pid_t pid = ::atoi(parts[1].c_str());
+
+			service_t s;
+
+			// if running
+			if (pid > 0 && s.import(get_config_filepath(parts[0]))
+					&& s.attach(pid))
+			{
+				debug.w("%s service is already running... pid = %d",
+						s.cfg.name.c_str(), pid);
+				running_services[s.cfg.name] = s;
+				supervise(running_services[s.cfg.name]);
+			}
+		}
+	} // end-of-for lines
+}
+
+void service_server::save_service_list()
+{
+	stringstream ss;
+	for (map<string, service_t>::const_iterator it = running_services.begin();
+			it != running_services.end(); ++it)
+	{
+		const service_t & s = it->second;
+		if (s.is_running())
+		{
+			ss << s.cfg.name << SERVICE_LIST_SEPERATOR << s.pid << endl;
+		}
+	}
+
+	if (fileutils::save_file(filepath_service_list, ss.str(), 777))
+	{
+		debug.i("service list file updated.");
+	}
+	else
+	{
+		debug.e("Could not save service list file.");
+	}
+}
+
+void service_server::handle_lifecycle(BundleView & bundle, operation op)
+{
+	// single service
+	if (bundle.count() == 1 && bundle.getNextType() == Bundle::TYPE_STRING)
+	{
+		string name = bundle.getString();
+		string error;
+
+		switch (begin_operation(name, op, error))
+		{
+		case OP_OK:
+			send(client_address, Bundle() << true);
+			break;
+		case OP_FAILED:
+			send(client_address, Bundle() << false << error);
+			break;
+		case OP_PENDING:
+			break;
+		}
+		return;
+	}
+
+	if (bundle.count() < 2 || bundle.getNextType() != Bundle::TYPE_INT)
+	{
+		send(client_address,
+				Bundle() << false << "invalid argument.");
+		return;
+	}
+
+	int jobs = bundle.getInt();
+
+	vector<string> selectors;
+	while (bundle.count() > 0)
+		selectors.push_back(bundle.getString());
+
+	const map<string, config_t> & configs = load_dependencies();
+
+	int id = allocate_request_id();
+
+	bulk_request & r = bulk_requests[id];
+	r.client = client_address;
+	r.op = op;
+	r.jobs = (jobs > 0) ? jobs : SERVICE_BULK_JOBS;
+	r.started = Timer::getCurrentClock();
+
+	vector<string> unmatched;
+	select_services(selectors, r.names, unmatched);
+
+	plan_bulk(r, configs);
+
+	// only a cycle among the planned services would block the request
+	string error;
+	if (!check_dependencies(configs,
+			set<string>(r.names.begin(), r.names.end()), error))
+	{
+		bulk_requests.erase(id);
+		send(client_address, Bundle() << false << error);
+		return;
+	}
+
+	for (size_t i = 0; i < unmatched.size(); ++i)
+	{
+		r.names.push_back(unmatched[i]);
+		r.results[unmatched[i]] = make_pair(false, string("no service matches."));
+	}
+
+	bulk_step(id);
+}
+
+service_server::OperationResult service_server::start_operation(
+		const std::string & name, std::string & error)
+{
+	map<string, service_t>::iterator it = running_services.find(name);
+
+	if (it != running_services.end())
+	{
+		service_t & s = it->second;
+
+		// start again when stop completes
+		if (s.state == service_t::ST_STOPPING
+				|| s.state == service_t::ST_KILLING)
+		{
+			s.restart_pending = true;
+			return OP_PENDING;
+		}
+
+		// if already running
+		if (s.is_running())
+			return OP_OK;
+	}
+
+	return start_service(name, error) ? OP_OK : OP_FAILED;
+}
+
+service_server::OperationResult service_server::stop_operation(
+		const std::string & name, std::string & error)
+{
+	string filepath_cfg = get_config_filepath(name);
+	bool found = fileutils::exist(filepath_cfg, fileutils::FT_REG);
+
+	map<string, service_t>::iterator it = running_services.find(name);
+
+	// if already stopped
+	if (it == running_services.end() && found)
+		return OP_OK;
+
+	if (it == running_services.end())
+	{
+		error = "config file not found.";
+		return OP_FAILED;
+	}
+
+	service_t & s = it->second;
+
+	// if it is already stopped (waiting for respawn)
+	if (!s.is_running())
+	{
+		retire(it);
+		save_service_list();
+		return OP_OK;
+	}
+
+	// cancel restart if stopping, completes when process exits
+	s.restart_pending = false;
+
+	if (s.state == service_t::ST_RUNNING && !begin_stop(it))
+	{
+		error = "stop() failed.";
+		return OP_FAILED;
+	}
+
+	return OP_PENDING;
+}
+
+service_server::OperationResult service_server::restart_operation(
+		const std::string & name, std::string & error)
+{
+	map<string, service_t>::iterator it = running_services.find(name);
+
+	// stop if running, started again when stop completes
+	if (it != running_services.end() && it->second.is_running())
+	{
+		service_t & s = it->second;
+
+		s.restart_pending = true;
+
+		if (s.state == service_t::ST_RUNNING && !begin_stop(it))
+		{
+			s.restart_pending = false;
+			error = "stop() failed.";
+			return OP_FAILED;
+		}
+
+		return OP_PENDING;
+	}
+
+	// start
+	return start_service(name, error) ? OP_OK : OP_FAILED;
+}
+
+void service_server::select_services(const std::vector<std::string> & selectors,
+		std::vector<std::string> & names, std::vector<std::string> & unmatched)
+{
+	// known services: config files and running services
+	set<string> known;
+	bool listed = false;
+	set<string> selected;
+
+	for (size_t i = 0; i < selectors.size(); ++i)
+	{
+		const string & sel = selectors[i];
+
+		// plain name, operation reports unknown services
+		if (sel.find_first_of("*?[") == string::npos)
+		{
+			if (selected.insert(sel).second)
+				names.push_back(sel);
+			continue;
+		}
+
+		if (!listed)
+		{
+			vector<string> filenames;
+			fileutils::read_dir(dirpath_service, filenames);
+
+			for (size_t j = 0; j < filenames.size(); ++j)
+			{
+				if (fileutils::extension(filenames[j]) == FILE_EXTENSION_CONFIG)
+					known.insert(fileutils::basename2(filenames[j], true));
+			}
+
+			for (map<string, service_t>::const_iterator it =
+					running_services.begin(); it != running_services.end(); ++it)
+				known.insert(it->first);
+
+			listed = true;
+		}
+
+		bool matched = false;
+		for (set<string>::const_iterator it = known.begin(); it != known.end();
+				++it)
+		{
+			if (::fnmatch(sel.c_str(), it->c_str(), 0) != 0)
+				continue;
+
+			matched = true;
+			if (selected.insert(*it).second)
+				names.push_back(*it);
+		}
+
+		// reported once, the request completes when every name has a result
+		if (!matched && selected.insert(sel).second)
+			unmatched.push_back(sel);
+	}
+}
+
+const std::map<std::string, config_t> & service_server::load_dependencies()
+{
+	// cached until the service directory changes, re-read if not watched
+	if (dependencies_loaded && config_watch_fd >= 0)
+		return dependency_configs;
+
+	dependency_configs.clear();
+
+	vector<string> filenames;
+	fileutils::read_dir(dirpath_service, filenames);
 
 	for (size_t i = 0; i < filenames.size(); ++i)
 	{
-		if (fileutils::extension(filenames[i]) == FILE_EXTENSION_CONFIG)
+		if (fileutils::extension(filenames[i]) != FILE_EXTENSION_CONFIG)
+			continue;
+
+		config_t cfg;
+		if (cfg.import(dirpath_service + "/" + filenames[i]))
+			dependency_configs[cfg.name] = cfg;
+	}
+
+	dependencies_loaded = true;
+
+	return dependency_configs;
+}
+
+bool service_server::check_dependencies(
+		const std::map<std::string, config_t> & configs,
+		const std::set<std::string> & names, std::string & error)
+{
+	// depth first search, a service on the path seen again is a cycle
+	map<string, int> color;	// 0: not visited, 1: on path, 2: done
+
+	for (set<string>::const_iterator root = names.begin(); root != names.end();
+			++root)
+	{
+		if (color[*root] != 0 || configs.find(*root) == configs.end())
+			continue;
+
+		// path of (service, next dependency index)
+		vector<pair<string, size_t> > path;
+		path.push_back(make_pair(*root, (size_t) 0));
+		color[*root] = 1;
+
+		while (!path.empty())
+		{
+			const config_t & cfg = configs.find(path.back().first)->second;
+			size_t & next = path.back().second;
+			size_t n_required = cfg.required_services.size();
+
+			if (next >= n_required + cfg.after_services.size())
+			{
+				color[path.back().first] = 2;
+				path.pop_back();
+				continue;
+			}
+
+			const string & dep =
+					next < n_required ?
+							cfg.required_services[next] :
+							cfg.after_services[next - n_required];
+			++next;
+
+			// unknown services fail when started, others are not ordered
+			if (names.find(dep) == names.end()
+					|| configs.find(dep) == configs.end() || color[dep] == 2)
+				continue;
+
+			if (color[dep] == 1)
+			{
+				error = "dependency cycle:";
+
+				size_t i = 0;
+				while (path[i].first != dep)
+					++i;
+				for (; i < path.size(); ++i)
+					error += " " + path[i].first + " ->";
+				error += " " + dep;
+
+				return false;
+			}
+
+			color[dep] = 1;
+			path.push_back(make_pair(dep, (size_t) 0));
+		}
+	}
+
+	return true;
+}
+
+void service_server::plan_bulk(bulk_request & r,
+		const std::map<std::string, config_t> & configs)
+{
+	bool stopping = (r.op == &service_server::stop_operation);
+	set<string> selected(r.names.begin(), r.names.end());
+
+	// START brings up required services too
+	for (size_t i = 0; i < r.names.size()
+			&& r.op == &service_server::start_operation; ++i)
+	{
+		map<string, config_t>::const_iterator it = configs.find(r.names[i]);
+		if (it == configs.end())
+			continue;
+
+		const vector<string> & required = it->second.required_services;
+		for (size_t j = 0; j < required.size(); ++j)
+		{
+			if (selected.insert(required[j]).second)
+				r.names.push_back(required[j]);
+		}
+	}
+
+	for (size_t i = 0; i < r.names.size(); ++i)
+	{
+		const string & name = r.names[i];
+
+		map<string, config_t>::const_iterator it = configs.find(name);
+		if (it == configs.end())
+			continue;
+
+		const config_t & cfg = it->second;
+
+		set<string> deps(cfg.required_services.begin(),
+				cfg.required_services.end());
+		deps.insert(cfg.after_services.begin(), cfg.after_services.end());
+
+		for (set<string>::const_iterator dep = deps.begin(); dep != deps.end();
+				++dep)
+		{
+			if (*dep == name || selected.find(*dep) == selected.end())
+				continue;
+
+			// dependents are stopped first
+			const string & first = stopping ? name : *dep;
+			const string & second = stopping ? *dep : name;
+
+			r.dependents[first].push_back(second);
+			++r.blockers[second];
+
+			if (!stopping
+					&& find(cfg.required_services.begin(),
+							cfg.required_services.end(), *dep)
+							!= cfg.required_services.end())
+				r.required[name].insert(*dep);
+		}
+	}
+
+	for (size_t i = 0; i < r.names.size(); ++i)
+	{
+		if (r.blockers[r.names[i]] == 0)
+			r.queue.push_back(r.names[i]);
+	}
+}
+
+int service_server::allocate_request_id()
+{
+	while (true)
+	{
+		int id = next_request_id;
+
+		// wrap before overflowing, ids stay positive
+		next_request_id = (id == INT_MAX) ? 1 : id + 1;
+
+		if (bulk_requests.find(id) == bulk_requests.end()
+				&& batches.find(id) == batches.end())
+			return id;
+	}
+}
+
+void service_server::bulk_step(int request_id)
+{
+	map<int, bulk_request>::iterator it = bulk_requests.find(request_id);
+	if (it == bulk_requests.end())
+		return;
+
+	bulk_request & r = it->second;
+
+	while (!r.queue.empty() && r.in_flight.size() < r.jobs)
+	{
+		string name = r.queue.front();
+		r.queue.pop_front();
+
+		string error;
+		switch (begin_operation(name, r.op, error, request_id))
+		{
+		case OP_OK:
+			bulk_done(r, name, true, "");
+			break;
+		case OP_FAILED:
+			bulk_done(r, name, false, error);
+			break;
+		case OP_PENDING:
+			r.in_flight.insert(name);
+			break;
+		}
+	}
+
+	if (r.results.size() < r.names.size())
+		return;
+
+	// all completed, reply in selection order
+	bool all_ok = true;
+	for (size_t i = 0; i < r.names.size(); ++i)
+		all_ok = all_ok && r.results[r.names[i]].first;
+
+	Bundle response;
+	response << all_ok << (int) r.names.size();
+
+	for (size_t i = 0; i < r.names.size(); ++i)
+	{
+		const pair<bool, string> & result = r.results[r.names[i]];
+		response << r.names[i] << result.first << result.second;
+	}
+
+	response << critical_path(r);
+
+	send(r.client, response);
+
+	bulk_requests.erase(it);
+}
+
+void service_server::bulk_done(bulk_request & r, const std::string & name,
+		bool ok, const std::string & error)
+{
+	r.results[name] = make_pair(ok, error);
+	r.finished[name] = Timer::getCurrentClock() - r.started;
+
+	map<string, vector<string> >::iterator it = r.dependents.find(name);
+	if (it == r.dependents.end())
+		return;
+
+	const vector<string> & dependents = it->second;
+
+	for (size_t i = 0; i < dependents.size(); ++i)
+	{
+		const string & d = dependents[i];
+
+		// already failed by another required service
+		if (r.results.find(d) != r.results.end())
+			continue;
+
+		if (!ok && r.required[d].count(name))
+		{
+			bulk_done(r, d, false, "required service " + name + " failed.");
+			continue;
+		}
+
+		if (--r.blockers[d] == 0)
+		{
+			r.critical[d] = name;
+			r.queue.push_back(d);
+		}
+	}
+}
+
+std::string service_server::critical_path(const bulk_request & r)
+{
+	if (r.dependents.empty() || r.finished.empty())
+		return "";
+
+	// service completed last
+	map<string, uint64_t>::const_iterator last = r.finished.begin();
+	for (map<string, uint64_t>::const_iterator it = r.finished.begin();
+			it != r.finished.end(); ++it)
+	{
+		if (it->second > last->second)
+			last = it;
+	}
+
+	// walk back through the dependencies waited for
+	vector<string> chain;
+	string name = last->first;
+
+	while (true)
+	{
+		map<string, uint64_t>::const_iterator f = r.finished.find(name);
+		chain.push_back(
+				name + " (" + stringutils::to_string(f->second) + " ms)");
+
+		map<string, string>::const_iterator c = r.critical.find(name);
+		if (c == r.critical.end())
+			break;
+
+		name = c->second;
+	}
+
+	string path;
+	for (size_t i = chain.size(); i > 0; --i)
+	{
+		path += chain[i - 1];
+		if (i > 1)
+			path += " -> ";
+	}
+
+	return path;
+}
+
+void service_server::handle_START(BundleView & bundle)
+{
+	handle_lifecycle(bundle, &service_server::start_operation);
+}
+
+void service_server::handle_STOP(BundleView & bundle)
+{
+	handle_lifecycle(bundle, &service_server::stop_operation);
+}
+
+void service_server::handle_RESTART(BundleView & bundle)
+{
+	handle_lifecycle(bundle, &service_server::restart_operation);
+}
+
+void service_server::handle_STATUS(BundleView & bundle)
+{
+	if (bundle.count() != 1)
+	{
+		send(client_address,
+				Bundle() << false << "invalid argument.");
+		return;
+	}
+
+	string name = bundle.getString();
+
+	map<string, service_t>::iterator it = running_services.find(name);
+
+	send(client_address,
+			Bundle() << true
+					<< (it != running_services.end() && it->second.is_running()));
+}
+
+void service_server::handle_SHOW(BundleView & bundle)
+{
+	if (bundle.count() != 1)
+	{
+		send(client_address,
+				Bundle() << false << "invalid argument.");
+		return;
+	}
+
+	string name = bundle.getString();
+	Bundle response;
+
+	map<string, service_t>::iterator it = running_services.find(name);
+	if (it != running_services.end())
+	{
+		send(client_address, Bundle() << true// command response
+				<< it->second);	// information
+		return;
+	}
+
+	string filepath_cfg = get_config_filepath(name);
+	if (!fileutils::exist(filepath_cfg))
+	{
+		send(client_address,
+				Bundle() << false << "config file not found.");
+		return;
+	}
+
+	// show last run of a stopped service with the current config
+	service_t s;
+	map<string, service_t>::const_iterator st = stopped_services.find(name);
+	if (st != stopped_services.end())
+		s = st->second;
+
+	if (!s.cfg.import(filepath_cfg))
+	{
+		send(client_address,
+				Bundle() << false << "error in config file.");
+		return;
+	}
+
+	send(client_address, Bundle() << true	// command response
+			<< s);	// information
+}
+
+void service_server::handle_LIST(BundleView & bundle)
+{
+	string cursor;
+	int page_size = 0;
+	int fields = 0;
+
+	// optional: [cursor, page size, field mask]
+	if (bundle.count() == 3 && bundle.getNextType() == Bundle::TYPE_STRING)
+	{
+		cursor = bundle.getString();
+
+		if (bundle.getNextType() == Bundle::TYPE_INT)
+			page_size = bundle.getInt();
+		if (bundle.getNextType() == Bundle::TYPE_INT)
+			fields = bundle.getInt();
+	}
+
+	// an invalid request does not touch a LIST in progress
+	if (bundle.count() != 0)
+	{
+		send(client_address, Bundle() << false << "invalid argument.");
+		return;
+	}
+
+	// replaces a previous LIST of the same client
+	list_stream & ls = streams[client_address];
+	ls.cursor = cursor;
+	ls.remaining = (page_size > 0) ? page_size : -1;
+	ls.fields = (fields != 0) ? (fields | service_t::F_NAME) : 0;
+
+	refresh_config_names();
+
+	continue_streams();
+}
+
+void service_server::continue_streams()
+{
+	for (map<string, list_stream>::iterator it = streams.begin();
+			it != streams.end();)
+	{
+		const string & client = it->first;
+		list_stream & ls = it->second;
+		bool done = false;
+
+		// response chunks: [true, more, next page cursor, fields, record...]
+		while (!done && domain_server.pending(client) < SERVICE_STREAM_WINDOW)
 		{
-			// if it can be imported
-			if (temp.import(dirpath_service + "/" + filenames[i]))
+			Bundle records;
+			string name;
+			bool end = false;
+
+			for (int n = 0; n < SERVICE_LIST_CHUNK && ls.remaining != 0;)
 			{
-				// if not found in running services
-				if (all_services.find(temp.cfg.name) == all_services.end())
+				if (!next_service_name(ls.cursor, name))
+				{
+					end = true;
+					break;
+				}
+
+				ls.cursor = name;
+
+				if (write_service(records, name, ls.fields))
 				{
-					all_services[temp.cfg.name] = temp;
+					++n;
+					if (ls.remaining > 0)
+						--ls.remaining;
 				}
 			}
+
+			// page is full, tell where the next one starts
+			bool more = !end && ls.remaining != 0;
+			string next_page;
+			if (!end && !more && next_service_name(ls.cursor, name))
+				next_page = ls.cursor;
+
+			Bundle response;
+			response << true << more << next_page << ls.fields;
+			response << records;
+
+			// completed, or client is gone
+			done = !domain_server.sendto(client, response) || !more;
+		}
+
+		if (done)
+			streams.erase(it++);
+		else
+			++it;
+	}
+}
+
+void service_server::handle_BATCH(BundleView & bundle)
+{
+	int count = (bundle.count() > 0
+			&& bundle.getNextType() == Bundle::TYPE_INT) ? bundle.getInt() : -1;
+
+	// each command takes at least an element count and a name
+	if (count < 0 || count > bundle.count() / 2)
+	{
+		send(client_address, Bundle() << false << "invalid argument.");
+		return;
+	}
+
+	int id = allocate_request_id();
+
+	batch_request & b = batches[id];
+	b.client = client_address;
+	b.replies.resize(count);
+	// held until all commands are dispatched, replies may complete it earlier
+	b.remaining = count + 1;
+
+	const string client = client_address;
+	// read position after a malformed command is unknown
+	bool parsed = true;
+
+	for (int i = 0; i < count; ++i)
+	{
+		char slot[48];
+		::snprintf(slot, sizeof(slot), ":batch:%d:%d", id, i);
+		batch_slots[slot] = make_pair(id, (size_t) i);
+
+		if (!parsed)
+		{
+			send(slot, Bundle() << false << "invalid argument.");
+			continue;
+		}
+
+		BundleView command;
+		string name;
+
+		try
+		{
+			int elements = bundle.getInt();
+			bundle.getView(command, elements);
+			name = command.getString();
+		} catch (exception & e)
+		{
+			parsed = false;
+			send(slot, Bundle() << false << "invalid argument.");
+			continue;
+		}
+
+		map<string, void (service_server::*)(BundleView &)>::iterator handler =
+				command_handlers.find(name);
+
+		if (handler == command_handlers.end())
+		{
+			send(slot, Bundle() << false << "unknown command");
+			continue;
+		}
+
+		// one reply per command, streams and nested batches can not be batched
+		if (name == SERVICE_CMD_LIST || name == SERVICE_CMD_SUBSCRIBE
+				|| name == SERVICE_CMD_BATCH)
+		{
+			send(slot, Bundle() << false << "not allowed in batch.");
+			continue;
+		}
+
+		// replies of the command are recorded in the batch
+		client_address = slot;
+
+		try
+		{
+			(this->*(handler->second))(command);
+		} catch (exception & e)
+		{
+			debug.e(e.what());
+
+			// a batch never completes without the reply
+			if (batch_slots.find(slot) != batch_slots.end())
+				send(slot, Bundle() << false << e.what());
+		}
+
+		client_address = client;
+	}
+
+	--batches[id].remaining;
+	finish_batch(id);
+}
+
+bool service_server::send(const std::string & client, const Bundle & response)
+{
+	map<string, pair<int, size_t> >::iterator slot = batch_slots.find(client);
+	if (slot == batch_slots.end())
+		return domain_server.sendto(client, response);
+
+	int id = slot->second.first;
+	size_t index = slot->second.second;
+
+	// a command replies once
+	batch_slots.erase(slot);
+
+	map<int, batch_request>::iterator b = batches.find(id);
+	if (b == batches.end())
+		return false;
+
+	b->second.replies[index] = response;
+	--b->second.remaining;
+
+	finish_batch(id);
+
+	return true;
+}
+
+void service_server::finish_batch(int batch_id)
+{
+	map<int, batch_request>::iterator it = batches.find(batch_id);
+	if (it == batches.end() || it->second.remaining != 0)
+		return;
+
+	batch_request & b = it->second;
+	Bundle response;
+
+	response << true << (int) b.replies.size();
+	for (size_t i = 0; i < b.replies.size(); ++i)
+		response << b.replies[i].count() << b.replies[i];
+
+	send(b.client, response);
+
+	batches.erase(it);
+}
+
+void service_server::handle_SUBSCRIBE(BundleView & bundle)
+{
+	// replaces a previous subscription of the same client
+	subscriber & sub = subscribers[client_address];
+	sub.selectors.clear();
+	sub.queue.clear();
+	sub.dropped = 0;
+
+	while (bundle.count() > 0)
+		sub.selectors.push_back(bundle.getString());
+
+	if (!domain_server.sendto(client_address, Bundle() << true))
+		subscribers.erase(client_address);
+}
+
+void service_server::publish(const char * event, const std::string & name,
+		pid_t pid, int value)
+{
+	update_status(name);
+
+	if (subscribers.empty())
+		return;
+
+	Bundle e;
+	e << (int) ::time(NULL) << event << name << (int) pid << value;
+
+	for (map<string, subscriber>::iterator it = subscribers.begin();
+			it != subscribers.end(); ++it)
+	{
+		subscriber & sub = it->second;
+
+		bool selected = sub.selectors.empty();
+		for (size_t i = 0; !selected && i < sub.selectors.size(); ++i)
+			selected = (::fnmatch(sub.selectors[i].c_str(), name.c_str(), 0) == 0);
+
+		if (!selected)
+			continue;
+
+		// slow subscriber, keep the daemon's memory bounded
+		if (sub.queue.size() >= SERVICE_WATCH_QUEUE)
+		{
+			++sub.dropped;
+			continue;
+		}
+
+		sub.queue.push_back(e);
+	}
+
+	flush_events();
+}
+
+void service_server::flush_events()
+{
+	for (map<string, subscriber>::iterator it = subscribers.begin();
+			it != subscribers.end();)
+	{
+		const string & client = it->first;
+		subscriber & sub = it->second;
+		bool gone = false;
+
+		// events: [true, dropped, time, event, name, pid, value]
+		while (!gone && !sub.queue.empty()
+				&& domain_server.pending(client) < SERVICE_WATCH_WINDOW)
+		{
+			Bundle event;
+			event << true << sub.dropped;
+			event << sub.queue.front();
+
+			gone = !domain_server.sendto(client, event);
+			sub.queue.pop_front();
+		}
+
+		if (gone)
+			subscribers.erase(it++);
+		else
+			++it;
+	}
+}
+
+void service_server::update_status(const std::string & name)
+{
+	if (!board.is_open())
+		return;
+
+	const service_t * s = NULL;
+
+	map<string, service_t>::const_iterator it = running_services.find(name);
+	if (it != running_services.end())
+		s = &it->second;
+	else if ((it = stopped_services.find(name)) != stopped_services.end())
+		s = &it->second;
+
+	if (s == NULL && config_names.find(name) == config_names.end())
+	{
+		board.remove(name);
+		return;
+	}
+
+	status_board::status st;
+	st.name = name;
+	st.pid = -1;
+	st.state = service_t::ST_STOPPED;
+	st.respawn_count = 0;
+	st.exit_code = -1;
+	st.start_time = 0;
+
+	if (s != NULL)
+	{
+		st.pid = s->is_running() ? s->pid : -1;
+		st.state = s->state;
+		st.respawn_count = s->respawn_count;
+		st.exit_code = s->exit_code;
+		st.start_time = s->start_time;
+	}
+
+	// readers can not rely on a board missing a service
+	if (!board.update(st))
+		board.set_complete(false);
+}
+
+void service_server::sync_status()
+{
+	if (!board.is_open())
+		return;
+
+	refresh_config_names();
+
+	set<string> names(config_names);
+	for (map<string, service_t>::const_iterator it = running_services.begin();
+			it != running_services.end(); ++it)
+		names.insert(it->first);
+	for (map<string, service_t>::const_iterator it = stopped_services.begin();
+			it != stopped_services.end(); ++it)
+		names.insert(it->first);
+
+	// release slots of removed configs
+	vector<string> slots;
+	board.names(slots);
+	for (size_t i = 0; i < slots.size(); ++i)
+	{
+		if (names.find(slots[i]) == names.end())
+			board.remove(slots[i]);
+	}
+
+	// complete unless a service does not fit, new configs are only seen if watched
+	board.set_complete(config_watch_fd >= 0);
+
+	for (set<string>::const_iterator it = names.begin(); it != names.end(); ++it)
+		update_status(*it);
+}
+
+void service_server::refresh_config_names()
+{
+	struct stat st;
+
+	if (::stat(dirpath_service.c_str(), &st) < 0)
+	{
+		config_names.clear();
+		config_dir_mtime.tv_sec = config_dir_mtime.tv_nsec = 0;
+		return;
+	}
+
+	if (st.st_mtim.tv_sec == config_dir_mtime.tv_sec
+			&& st.st_mtim.tv_nsec == config_dir_mtime.tv_nsec)
+		return;
+
+	config_dir_mtime = st.st_mtim;
+	config_names.clear();
+
+	vector<string> filenames;
+
+	fileutils::read_dir(dirpath_service, filenames);
+
+	for (size_t i = 0; i < filenames.size(); ++i)
+	{
+		if (fileutils::extension(filenames[i]) == FILE_EXTENSION_CONFIG)
+			config_names.insert(fileutils::basename2(filenames[i], true));
+	}
+}
+
+bool service_server::next_service_name(const std::string & cursor,
+		std::string & name) const
+{
+	map<string, service_t>::const_iterator r = running_services.upper_bound(
+			cursor);
+	set<string>::const_iterator c = config_names.upper_bound(cursor);
+
+	bool has_r = (r != running_services.end());
+	bool has_c = (c != config_names.end());
+
+	if (!has_r && !has_c)
+		return false;
+
+	if (has_r && (!has_c || r->first < *c))
+		name = r->first;
+	else
+		name = *c;
+
+	return true;
+}
+
+bool service_server::write_service(Bundle & response, const std::string & name,
+		int fields)
+{
+	map<string, service_t>::const_iterator it = running_services.find(name);
+	if (it != running_services.end())
+	{
+		if (fields == 0)
+			response << it->second;
+		else
+			it->second.write_fields(response, fields);
+		return true;
+	}
+
+	map<string, service_t>::const_iterator st = stopped_services.find(name);
+
+	// config is only parsed if a config field is requested
+	if (fields != 0 && !(fields & service_t::CONFIG_FIELDS))
+	{
+		if (st != stopped_services.end())
+		{
+			st->second.write_fields(response, fields);
+			return true;
 		}
+
+		service_t s;
+		s.cfg.name = name;
+		s.write_fields(response, fields);
+		return true;
 	}
 
+	// last run of a stopped service with the current config
+	service_t s;
+	if (st != stopped_services.end())
+		s = st->second;
+
+	if (!s.cfg.import(get_config_filepath(name)))
+		return false;
+
+	if (fields == 0)
+		response << s;
+	else
+		s.write_fields(response, fields);
+
 	return true;
 }
 
 void service_server::init()
 {
 	config_init();
+	reactor_init();
+	reaper_init();
 	ipc_init();
+	status_init();
 	handler_init();
 
 	debug.i("file paths:");
 	debug.i("service directory: %s", DIRPATH_SERVICES);
-	debug.i("service script directory: %s", DIRPATH_SERVICE_SCRIPTS);
 	debug.i("service pid directory: %s", DIRPATH_SERVICE_PIDS);
 	debug.i("service list: %s", FILEPATH_SERVICES_LIST);
+	debug.i("service status: %s", FILEPATH_SERVICES_STATUS);
 }
 
 void service_server::finalize()
 {
+	status_finalize();
 	ipc_finalize();
+	reaper_finalize();
+	reactor_finalize();
 }
 
 void service_server::config_init()
 {
 	filepath_service_list = FILEPATH_SERVICES_LIST;
+
+	// file creation mask of services, posix_spawn() can not set it per child
+	::umask(0);
+}
+
+void service_server::reactor_init()
+{
+	epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0)
+	{
+		debug.e("epoll_create1() failed: %s", strerror(errno));
+		exit(1);
+	}
+
+	if (!timers.open()
+			|| !watch(timers.getFd(), EPOLLIN, &service_server::on_timer_event))
+	{
+		debug.e("Could not create timer: %s", strerror(errno));
+		exit(1);
+	}
+}
+
+void service_server::reactor_finalize()
+{
+	if (timers.getFd() >= 0)
+	{
+		unwatch(timers.getFd());
+		timers.close();
+	}
+
+	if (epoll_fd >= 0)
+	{
+		::close(epoll_fd);
+		epoll_fd = -1;
+	}
+}
+
+void service_server::reaper_init()
+{
+	// services are direct children, stay the parent of processes they fork off
+	if (::prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+		debug.e("prctl(PR_SET_CHILD_SUBREAPER) failed: %s", strerror(errno));
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+
+	if (::sigprocmask(SIG_BLOCK, &mask, NULL) < 0)
+	{
+		debug.e("sigprocmask() failed: %s", strerror(errno));
+		exit(1);
+	}
+
+	sigchld_fd = ::signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sigchld_fd < 0
+			|| !watch(sigchld_fd, EPOLLIN, &service_server::on_sigchld_event))
+	{
+		debug.e("Could not watch SIGCHLD: %s", strerror(errno));
+		exit(1);
+	}
+}
+
+void service_server::reaper_finalize()
+{
+	if (sigchld_fd >= 0)
+	{
+		unwatch(sigchld_fd);
+		::close(sigchld_fd);
+		sigchld_fd = -1;
+	}
 }
 
 void service_server::ipc_init()
@@ -529,6 +1969,12 @@ void service_server::ipc_init()
 	}
 
 	domain_server.setBlockingMode(false);
+
+	if (!watch(domain_server.getFd(), EPOLLIN, &service_server::on_ipc_event))
+	{
+		debug.e("Could not watch domain server socket.");
+		exit(1);
+	}
 }
 
 void service_server::ipc_finalize()
@@ -536,6 +1982,52 @@ void service_server::ipc_finalize()
 	domain_server.close();
 }
 
+void service_server::status_init()
+{
+	fileutils::mkdir(DIRPATH_SERVICE_PIDS, 0755);
+
+	// clients fall back to queries without the board
+	if (!board.create(FILEPATH_SERVICES_STATUS))
+	{
+		debug.e("Could not create status board.");
+		return;
+	}
+
+	config_watch_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (config_watch_fd < 0)
+	{
+		debug.e("inotify_init1() failed: %s", strerror(errno));
+		return;
+	}
+
+	if (::inotify_add_watch(config_watch_fd, dirpath_service.c_str(),
+			IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_CLOSE_WRITE
+					| IN_ONLYDIR) < 0
+			|| !watch(config_watch_fd, EPOLLIN,
+					&service_server::on_config_dir_event))
+	{
+		debug.w("Could not watch service directory, status board is partial.");
+		::close(config_watch_fd);
+		config_watch_fd = -1;
+	}
+}
+
+void service_server::status_finalize()
+{
+	if (config_watch_fd >= 0)
+	{
+		unwatch(config_watch_fd);
+		::close(config_watch_fd);
+		config_watch_fd = -1;
+	}
+
+	if (board.is_open())
+	{
+		::unlink(FILEPATH_SERVICES_STATUS);
+		board.close();
+	}
+}
+
 void service_server::handler_init()
 {
 	command_handlers[SERVICE_CMD_START] = &service_server::handle_START;
@@ -544,5 +2036,7 @@ void service_server::handler_init()
 	command_handlers[SERVICE_CMD_STATUS] = &service_server::handle_STATUS;
 	command_handlers[SERVICE_CMD_SHOW] = &service_server::handle_SHOW;
 	command_handlers[SERVICE_CMD_LIST] = &service_server::handle_LIST;
+	command_handlers[SERVICE_CMD_SUBSCRIBE] = &service_server::handle_SUBSCRIBE;
+	command_handlers[SERVICE_CMD_BATCH] = &service_server::handle_BATCH;
 }
 
@@ -1,8 +1,9 @@
 #include "service_t.h"
 
 #include <fcntl.h>
-#include <sys/prctl.h>
+#include <spawn.h>
 #include <sys/resource.h>
+#include <sys/syscall.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <unistd.h>
@@ -14,18 +15,46 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <vector>
 
 #include "Debug.h"
 #include "fileutils.h"
 #include "stringutils.h"
 
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open		434
+#endif
+
+/** fd of the script in script service processes */
+#define SCRIPT_FD			3
+#define SCRIPT_FD_PATH		"/dev/fd/3"
+
 using namespace std;
 
+/**
+ * @brief Spawn attributes of processes started by the daemon: new session,
+ * default signal mask (daemon blocks SIGCHLD for its signalfd) and default
+ * SIGCHLD/SIGPIPE dispositions
+ */
+static void init_spawn_attributes(posix_spawnattr_t & attr)
+{
+	sigset_t mask, defaults;
+	sigemptyset(&mask);
+	sigemptyset(&defaults);
+	sigaddset(&defaults, SIGCHLD);
+	sigaddset(&defaults, SIGPIPE);
+
+	::posix_spawnattr_setflags(&attr,
+			POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF);
+	::posix_spawnattr_setsigmask(&attr, &mask);
+	::posix_spawnattr_setsigdefault(&attr, &defaults);
+}
+
 std::ostream & operator <<(std::ostream & o, const service_t & s)
 {
 	o << "name                  = " << s.cfg.name << endl
 			<< "status                = "
-			<< (s.is_running() ? "running" : "stopped") << endl
+			<< service_t::state_name(s.state) << endl
 			<< "pid                   = " << s.pid << endl
 			<< "cfg.exec              = " << s.cfg.exec << endl
 			<< "cfg.onstop_exec       = " << s.cfg.onstop_exec << endl
@@ -35,8 +64,18 @@ std::ostream & operator <<(std::ostream & o, const service_t & s)
 			<< "cfg.respawn           = " << (s.cfg.respawn ? "true" : "false")
 			<< endl << "cfg.respawn_limit     = " << s.cfg.respawn_limit << endl
 			<< "cfg.respawn_interval  = " << s.cfg.respawn_interval << endl
-			<< "respawn_count         = " << s.respawn_count << endl;
-//	  << "respawn_timer_enabled = " << s.respawn_timer_enabled << endl;
+			<< "cfg.stop_timeout      = " << s.cfg.stop_timeout << endl
+			<< "cfg.stop_signal       = " << s.cfg.stop_signal << endl
+			<< "cfg.requires          = "
+			<< stringutils::join(s.cfg.required_services, " ") << endl
+			<< "cfg.after             = "
+			<< stringutils::join(s.cfg.after_services, " ") << endl
+			<< "respawn_count         = " << s.respawn_count << endl
+			<< "last exit code        = " << s.exit_code << endl
+			<< "last exit signal      = " << s.exit_signal << endl
+			<< "last cpu time         = " << s.cpu_time << " s" << endl
+			<< "last max rss          = " << s.max_rss << " kB" << endl;
+//	  << "respawn_timer         = " << s.respawn_timer << endl;
 
 	return o;
 }
@@ -48,7 +87,7 @@ service_t::service_t()
 	clear();
 }
 
-bool service_t::start()
+bool service_t::start(script_cache & scripts)
 {
 	if (!cfg.is_valid())
 	{
@@ -62,91 +101,225 @@ bool service_t::start()
 		return false;
 	}
 
-	// remove old pid file
-	fileutils::remove(cfg.pidfile);
-
-	if (!daemonize())
+	if (!spawn(scripts))
+	{
+		pid = -1;
 		return false;
+	}
 
-	Timer t(3000);
-	while (!t.isTimeout())
+	return open_pidfd();
+}
+
+bool service_t::stop()
+{
+	if (state != ST_RUNNING)
 	{
-		pid = ::atoi(fileutils::load_file(cfg.pidfile).c_str());
-		if (pid > 0)
-		{
-			break;
-		}
+		DD("stop() failed: service is not running.\n");
+		return false;
+	}
 
-		usleep(100000);
+	if (::kill(pid, cfg.stop_signal))
+	{
+		DD("kill(%d, %d) failed: %s\n", pid, cfg.stop_signal, strerror(errno));
+		return false;
 	}
 
-	// invalidate pid
-	if (pid == 0)
-		pid = -1;
+	state = ST_STOPPING;
 
-	return pid > 0;
+	return true;
 }
 
-bool service_t::stop()
+bool service_t::kill()
 {
 	if (!is_running())
+		return false;
+
+	if (::kill(pid, SIGKILL) && errno != ESRCH)
 	{
-		DD("stop() failed: service is already stopped.\n");
+		DD("kill(%d, SIGKILL) failed: %s\n", pid, strerror(errno));
 		return false;
 	}
 
-	bool running = true;
+	state = ST_KILLING;
 
-	if (::kill(pid, SIGTERM))
+	return true;
+}
+
+bool service_t::is_running() const
+{
+	return state == ST_RUNNING || state == ST_STOPPING || state == ST_KILLING;
+}
+
+const char * service_t::state_name(State state)
+{
+	switch (state)
 	{
-		DD("kill(%d, SIGTERM) failed: %s\n", pid, strerror(errno));
+	case ST_STOPPED:
+		return "stopped";
+	case ST_STARTING:
+		return "starting";
+	case ST_RUNNING:
+		return "running";
+	case ST_STOPPING:
+		return "stopping";
+	case ST_KILLING:
+		return "killing";
 	}
-	else
+
+	return "unknown";
+}
+
+static const struct
+{
+	const char * name;
+	service_t::Field field;
+} field_names[] =
+{
+{ "name", service_t::F_NAME },
+{ "state", service_t::F_STATE },
+{ "pid", service_t::F_PID },
+{ "respawn_count", service_t::F_RESPAWN_COUNT },
+{ "exit_code", service_t::F_EXIT_CODE },
+{ "exit_signal", service_t::F_EXIT_SIGNAL },
+{ "cpu_time", service_t::F_CPU_TIME },
+{ "max_rss", service_t::F_MAX_RSS },
+{ "exec", service_t::F_EXEC },
+{ "log", service_t::F_LOG },
+{ "pidfile", service_t::F_PIDFILE } };
+
+#define FIELD_COUNT		(sizeof(field_names) / sizeof(field_names[0]))
+
+int service_t::parse_fields(const std::string & fields)
+{
+	vector<string> parts;
+	int mask = F_NAME;
+
+	stringutils::split(fields, ",", parts, false, true);
+
+	for (size_t i = 0; i < parts.size(); ++i)
 	{
-		Timer t;
-		t.set(3000);
-		while (!t.isTimeout())
-		{
-			if (!is_running())
-			{
-				running = false;
-				break;
-			}
+		size_t j = 0;
+		while (j < FIELD_COUNT && parts[i] != field_names[j].name)
+			++j;
 
-			usleep(100000);
-		}
+		if (j == FIELD_COUNT)
+			return -1;
+
+		mask |= field_names[j].field;
 	}
 
-	if (running)
+	return mask;
+}
+
+void service_t::write_fields(Bundle & bundle, int fields) const
+{
+	if (fields & F_NAME)
+		bundle << cfg.name;
+	if (fields & F_STATE)
+		bundle << (int) state;
+	if (fields & F_PID)
+		bundle << pid;
+	if (fields & F_RESPAWN_COUNT)
+		bundle << respawn_count;
+	if (fields & F_EXIT_CODE)
+		bundle << exit_code;
+	if (fields & F_EXIT_SIGNAL)
+		bundle << exit_signal;
+	if (fields & F_CPU_TIME)
+		bundle << cpu_time;
+	if (fields & F_MAX_RSS)
+		bundle << max_rss;
+	if (fields & F_EXEC)
+		bundle << cfg.exec;
+	if (fields & F_LOG)
+		bundle << cfg.logfile;
+	if (fields & F_PIDFILE)
+		bundle << cfg.pidfile;
+}
+
+void service_t::read_fields(Bundle & bundle, int fields)
+{
+	int st;
+
+	if (fields & F_NAME)
+		bundle >> cfg.name;
+	if (fields & F_STATE)
 	{
-		if (::kill(pid, SIGKILL) && errno != -ESRCH)
-		{
-			DD("kill(%d, SIGKILL) failed: %s\n", pid, strerror(errno));
-			return false;
-		}
-		else
-		{
-			running = false;
-		}
+		bundle >> st;
+		state = (State) st;
 	}
+	if (fields & F_PID)
+		bundle >> pid;
+	if (fields & F_RESPAWN_COUNT)
+		bundle >> respawn_count;
+	if (fields & F_EXIT_CODE)
+		bundle >> exit_code;
+	if (fields & F_EXIT_SIGNAL)
+		bundle >> exit_signal;
+	if (fields & F_CPU_TIME)
+		bundle >> cpu_time;
+	if (fields & F_MAX_RSS)
+		bundle >> max_rss;
+	if (fields & F_EXEC)
+		bundle >> cfg.exec;
+	if (fields & F_LOG)
+		bundle >> cfg.logfile;
+	if (fields & F_PIDFILE)
+		bundle >> cfg.pidfile;
+}
+
+std::string service_t::fields_to_string(int fields) const
+{
+	ostringstream oss;
 
-	if (!running)
+	for (size_t i = 0; i < FIELD_COUNT; ++i)
 	{
-		pid = -1;
-		fileutils::remove(cfg.pidfile);
+		Field f = field_names[i].field;
+		if (f == F_NAME || !(fields & f))
+			continue;
 
-		on_post_stop();
-	}
+		oss << " " << field_names[i].name << "=";
 
-	return true;
-}
+		switch (f)
+		{
+		case F_STATE:
+			oss << state_name(state);
+			break;
+		case F_PID:
+			oss << pid;
+			break;
+		case F_RESPAWN_COUNT:
+			oss << respawn_count;
+			break;
+		case F_EXIT_CODE:
+			oss << exit_code;
+			break;
+		case F_EXIT_SIGNAL:
+			oss << exit_signal;
+			break;
+		case F_CPU_TIME:
+			oss << cpu_time;
+			break;
+		case F_MAX_RSS:
+			oss << max_rss;
+			break;
+		case F_EXEC:
+			oss << cfg.exec;
+			break;
+		case F_LOG:
+			oss << cfg.logfile;
+			break;
+		case F_PIDFILE:
+			oss << cfg.pidfile;
+			break;
+		default:
+			break;
+		}
+	}
 
-bool service_t::is_running() const
-{
-	if (pid < 0)
-		return false;
+	string str = oss.str();
 
-	return ::kill(pid, 0) == 0;
+	return str.empty() ? str : str.substr(1);
 }
 
 bool service_t::import(const std::string & filepath)
@@ -161,98 +334,93 @@ bool service_t::import(const std::string & filepath)
 	return true;
 }
 
-bool service_t::daemonize()
+bool service_t::attach(pid_t pid)
 {
-	pid_t pid = ::fork();
-	if (pid < 0)
+	this->pid = pid;
+
+	if (!open_pidfd())
 	{
-		cerr << "fork() failed: " << strerror(errno) << endl;
+		this->pid = -1;
 		return false;
 	}
 
-	// return parent process
-	if (pid > 0)
-	{
-		// wait for child process to avoid zombie processes
-		int es;
-		wait(&es);
-		return true;
-	}
+	return true;
+}
 
-	// Start a new session for the daemon.
-	if (::setsid() == -1)
-	{
-		cerr << "setsid() failed: " << strerror(errno) << endl;
-		exit(1);
-	}
+void service_t::on_exit()
+{
+	state = ST_STOPPED;
+	close_pidfd();
+}
 
-	// fork again, allowing the parent process to terminate
-	::signal(SIGHUP, SIG_IGN);
-	pid = ::fork();
-	if (pid < 0)
-	{
-		cerr << "fork() failed: " << strerror(errno) << endl;
-		exit(1);
-	}
+bool service_t::reap()
+{
+	int status;
+	struct rusage ru;
 
-	// terminate parent process
-	if (pid > 0)
+	pid_t r = ::wait4(pid, &status, WNOHANG, &ru);
+	if (r <= 0)
 	{
-		exit(0);
+		// not a child of ours (or not exited yet)
+		set_exit_status(-1, NULL);
+		return false;
 	}
 
-	// change current directory
-	if (::chdir("/") == -1)
+	set_exit_status(status, &ru);
+
+	return true;
+}
+
+void service_t::set_exit_status(int status, const struct rusage * ru)
+{
+	exit_code = -1;
+	exit_signal = 0;
+	cpu_time = 0;
+	max_rss = 0;
+
+	if (ru == NULL)
+		return;
+
+	if (WIFEXITED(status))
+		exit_code = WEXITSTATUS(status);
+	else if (WIFSIGNALED(status))
+		exit_signal = WTERMSIG(status);
+
+	cpu_time = ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6
+			+ ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6;
+	max_rss = ru->ru_maxrss;
+}
+
+bool service_t::open_pidfd()
+{
+	close_pidfd();
+
+	pidfd = ::syscall(SYS_pidfd_open, pid, 0);
+	if (pidfd < 0)
 	{
-		cerr << "chdir() failed: " << strerror(errno) << endl;
-		exit(1);
+		// ESRCH: process is already gone
+		if (errno != ESRCH)
+			DD("pidfd_open(%d) failed: %s\n", pid, strerror(errno));
+		state = ST_STOPPED;
+		return false;
 	}
 
-	// set file creation mask
-	::umask(0);
-
-	// redirect std fds and close previously opened files/sockets (inherited from parent process)
-	redirect_fds();
-
-	// save pid file
-	fileutils::save_file(cfg.pidfile, stringutils::to_string(getpid()), 777);
-
-	// unset DEBUGLEVEL inherited from parent process
-	unsetenv("DEBUGLEVEL");
-
-	on_post_start();
-
-	// close and re-open standard file descriptors
-
-//	// close stdin
-//	::close(STDIN_FILENO);
-//	if (::open("/dev/null", O_RDONLY) == -1)
-//	{
-//		cerr << "open(stdin) failed: " << strerror(errno) << endl;
-//		exit(1);
-//	}
-//
-//	// enable logging for stdout/stderr
-//
-//	string fp_log = string("/dev/shm/log/") + __progname + ".log";
-//	int log_fd = ::open(fp_log.c_str(), O_CREAT | O_APPEND | O_RDWR, S_IRUSR | S_IWUSR | S_IRGRP);
-//	if (log_fd == -1)
-//	{
-//		cerr << "open(" << fp_log << ") failed: " << strerror(errno) << endl;
-//		exit(1);
-//	}
-//
-//	::dup2(log_fd, STDOUT_FILENO);
-//	::dup2(log_fd, STDERR_FILENO);
-//	::close(log_fd);
+	state = ST_RUNNING;
 
-	const char * sh = ::getenv("SHELL");
-	if (sh == NULL)
-		sh = service_t::default_shell.c_str();
+	return true;
+}
 
-	int r = -1;
+void service_t::close_pidfd()
+{
+	if (pidfd >= 0)
+		::close(pidfd);
 
-	// start daemon
+	pidfd = -1;
+}
+
+bool service_t::spawn(script_cache & scripts)
+{
+	int script_fd = -1;
 
 	if (cfg.is_script)
 	{
@@ -268,87 +436,124 @@ bool service_t::daemonize()
 			script_content = cfg.exec;
 		}
 
-		string pname = cfg.name + "-service";
+		// sealed memfd, created once per distinct script
+		script_fd = scripts.get(cfg.name, script_content);
+		if (script_fd < 0)
+		{
+			DD("%s : could not create script.\n", cfg.name.c_str());
+			return false;
+		}
+	}
+
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
 
-		fileutils::save_file(cfg.script_filepath, script_content, 777);
+	::posix_spawnattr_init(&attr);
+	::posix_spawn_file_actions_init(&actions);
 
-		char * const argv[] =
-		{ ::strdup(pname.c_str()),
-		NULL };
+	init_spawn_attributes(attr);
 
-		r = ::execvp(cfg.script_filepath.c_str(), argv);
-		DD("%s : exit_code = %d\n", cfg.name.c_str(), r);
+	// std fds, log file is opened here so the child only dup2()s it
+	int log_fd = open_log();
 
-		// free duplicates
-		for (int i = 0; argv[i] != NULL; ++i)
-			::free(argv[i]);
+	::posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+			config_t::null_device.c_str(), O_RDONLY, 0);
+
+	if (log_fd >= 0)
+	{
+		::posix_spawn_file_actions_adddup2(&actions, log_fd, STDOUT_FILENO);
+		::posix_spawn_file_actions_adddup2(&actions, log_fd, STDERR_FILENO);
 	}
 	else
 	{
+		::posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO,
+				config_t::null_device.c_str(), O_WRONLY, 0);
+		::posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO,
+				STDERR_FILENO);
+	}
 
-		// arguments
-		char * const argv[] =
-		{ ::strdup(sh), ::strdup("-c"), ::strdup(cfg.exec.c_str()),
-		NULL };
+#if __GLIBC_PREREQ(2, 29)
+	::posix_spawn_file_actions_addchdir_np(&actions, "/");
+#endif
 
-		r = ::execvp(sh, argv);
-		DD("%s : exit_code = %d\n", cfg.name.c_str(), r);
+	// script is executed as /dev/fd/<SCRIPT_FD>, interpreter reads it from there
+	if (script_fd >= 0)
+		::posix_spawn_file_actions_adddup2(&actions, script_fd, SCRIPT_FD);
 
-		// free duplicates
-		for (int i = 0; argv[i] != NULL; ++i)
-			::free(argv[i]);
+#if __GLIBC_PREREQ(2, 34)
+	// close_range() in the child, replaces the fstat() sweep up to RLIMIT_NOFILE
+	::posix_spawn_file_actions_addclosefrom_np(&actions,
+			script_fd >= 0 ? SCRIPT_FD + 1 : STDERR_FILENO + 1);
+#endif
+
+	// environment without DEBUGLEVEL of the daemon
+	vector<char *> envp;
+	for (char ** e = environ; *e != NULL; ++e)
+	{
+		if (::strncmp(*e, "DEBUGLEVEL=", 11) != 0)
+			envp.push_back(*e);
 	}
+	envp.push_back(NULL);
 
-	::exit(r);
-}
+	string path;
+	vector<string> args;
 
-void service_t::redirect_fds()
-{
-	struct rlimit rlim;
-	int ret;
-
-	if ((ret = ::getrlimit(RLIMIT_NOFILE, &rlim)) == -1)
+	if (cfg.is_script)
 	{
-		perror("getrlimit");
-		return;
+		path = SCRIPT_FD_PATH;
+		args.push_back(cfg.name + "-service");
+	}
+	else
+	{
+		const char * sh = ::getenv("SHELL");
+		if (sh == NULL)
+			sh = service_t::default_shell.c_str();
+
+		path = sh;
+		args.push_back(sh);
+		args.push_back("-c");
+		args.push_back(cfg.exec);
 	}
 
-	int maxFD = rlim.rlim_cur;
+	vector<char *> argv;
+	for (size_t i = 0; i < args.size(); ++i)
+		argv.push_back(const_cast<char *>(args[i].c_str()));
+	argv.push_back(NULL);
 
-	for (int i = 3; i < maxFD; ++i)
-	{
-		struct stat statbuf;
+	// vfork-like clone, exec errors are reported synchronously
+	pid_t child;
+	int r = ::posix_spawnp(&child, path.c_str(), &actions, &attr, &argv[0],
+			&envp[0]);
 
-		if (fstat(i, &statbuf) == -1)
-		{
-			if (errno == EBADF)
-			{
-//			   printf("file descriptor %d is not open\n", i);
-			}
-			else
-			{
-//			   perror("fstat");
-//			   exit(1);
-			}
-			continue;
-		}
+	::posix_spawn_file_actions_destroy(&actions);
+	::posix_spawnattr_destroy(&attr);
 
-		::close(i);
-	}
+	if (log_fd >= 0)
+		::close(log_fd);
 
-	// open standard input/outputs
-	int in = ::open(config_t::null_device.c_str(), O_RDONLY);
-	if (in == -1)
-	{
-		DD("open(in) failed: %d - %s\n", errno, ::strerror(errno));
-	}
-	else
+	if (r != 0)
 	{
-		::dup2(in, STDIN_FILENO);
-		::close(in);
+		DD("%s : posix_spawn(%s) failed: %s\n", cfg.name.c_str(), path.c_str(),
+				strerror(r));
+		return false;
 	}
 
-	int flags = O_CREAT | O_WRONLY | O_APPEND;
+	pid = child;
+	start_time = ::time(NULL);
+
+	// save pid file for external tools, daemon does not read it
+	if (!cfg.pidfile.empty())
+		fileutils::save_file(cfg.pidfile, stringutils::to_string(pid), 777);
+
+	return true;
+}
+
+int service_t::open_log()
+{
+	if (cfg.logfile == config_t::null_device)
+		return -1;
+
+	int flags = O_CREAT | O_WRONLY | O_APPEND | O_CLOEXEC;
 
 	// add O_TRUNC flag if it is need to be wiped
 	if (cfg.wipe_log)
@@ -356,46 +561,48 @@ void service_t::redirect_fds()
 		flags |= O_TRUNC;
 	}
 
-	int outerr = ::open(cfg.logfile.c_str(), flags);
-	if (outerr == -1)
+	int fd = ::open(cfg.logfile.c_str(), flags, 0666);
+	if (fd == -1)
 	{
 		DD("open(%s) failed: %d - %s\n", cfg.logfile.c_str(), errno, ::strerror(errno));
+		return -1;
 	}
-	else
-	{
-		::dup2(outerr, STDOUT_FILENO);
-		::dup2(outerr, STDERR_FILENO);
-		::close(outerr);
-	}
+
+	static const char started[] = "service: started.\n";
+	if (::write(fd, started, sizeof(started) - 1) < 0)
+		DD("write(%s) failed: %s\n", cfg.logfile.c_str(), ::strerror(errno));
+
+	return fd;
 }
 
 void service_t::clear()
 {
 	pid = -1;
+	pidfd = -1;
+	state = ST_STOPPED;
+	restart_pending = false;
+	stop_timer = 0;
 
 	cfg.clear();
 
-	respawn_count = 0;
+	exit_code = -1;
+	exit_signal = 0;
+	cpu_time = 0;
+	max_rss = 0;
+	start_time = 0;
 
-	respawn_timer_enabled = false;
-}
+	respawn_count = 0;
 
-void service_t::on_post_start()
-{
-	if (cfg.logfile == config_t::null_device)
-		return;
+	respawn_timer = 0;
 
-	ofstream ofs;
-	ofs.open(cfg.logfile.c_str(), ofstream::out | ofstream::app);
-	if (ofs.is_open())
-	{
-		ofs << "service: started." << endl;
-		ofs.close();
-	}
+	onstop_pid = -1;
+	onstop_pidfd = -1;
 }
 
 void service_t::on_post_stop()
 {
+	fileutils::remove(cfg.pidfile);
+
 	if (cfg.logfile != config_t::null_device)
 	{
 		ofstream ofs;
@@ -406,16 +613,89 @@ void service_t::on_post_stop()
 			ofs.close();
 		}
 	}
-	// run onstop command
-	::system(cfg.onstop_exec.c_str());
+}
+
+bool service_t::run_onstop()
+{
+	if (cfg.onstop_exec.empty())
+		return false;
+
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_t actions;
+
+	::posix_spawnattr_init(&attr);
+	::posix_spawn_file_actions_init(&actions);
+
+	init_spawn_attributes(attr);
+
+	// stdout/stderr of the daemon, as with system()
+	::posix_spawn_file_actions_addopen(&actions, STDIN_FILENO,
+			config_t::null_device.c_str(), O_RDONLY, 0);
+
+#if __GLIBC_PREREQ(2, 34)
+	::posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 1);
+#endif
+
+	const char * sh = ::getenv("SHELL");
+	if (sh == NULL)
+		sh = service_t::default_shell.c_str();
+
+	char * argv[] =
+	{ const_cast<char *>(sh), const_cast<char *>("-c"),
+			const_cast<char *>(cfg.onstop_exec.c_str()), NULL };
+
+	int r = ::posix_spawnp(&onstop_pid, sh, &actions, &attr, argv, environ);
+
+	::posix_spawn_file_actions_destroy(&actions);
+	::posix_spawnattr_destroy(&attr);
+
+	if (r != 0)
+	{
+		DD("%s : posix_spawn(onstop) failed: %s\n", cfg.name.c_str(),
+				strerror(r));
+		onstop_pid = -1;
+		return false;
+	}
+
+	onstop_pidfd = ::syscall(SYS_pidfd_open, onstop_pid, 0);
+	if (onstop_pidfd < 0)
+	{
+		DD("pidfd_open(%d) failed: %s\n", onstop_pid, strerror(errno));
+		onstop_exited();
+		return false;
+	}
+
+	return true;
+}
+
+void service_t::onstop_exited()
+{
+	// SIGCHLD handler of the daemon may have reaped it already
+	if (onstop_pid > 0)
+		::waitpid(onstop_pid, NULL, WNOHANG);
+
+	if (onstop_pidfd >= 0)
+		::close(onstop_pidfd);
+
+	onstop_pid = -1;
+	onstop_pidfd = -1;
 }
 
 void service_t::writeToBundle(Bundle & bundle) const
 {
-	bundle << cfg << pid << respawn_count;
+	bundle << cfg << pid << (int) state << respawn_count << exit_code
+			<< exit_signal << cpu_time << max_rss;
 }
 
 void service_t::readFromBundle(Bundle & bundle)
 {
-	bundle >> cfg >> pid >> respawn_count;
+	int st;
+
+	bundle >> cfg >> pid >> st >> respawn_count >> exit_code >> exit_signal
+			>> cpu_time >> max_rss;
+
+	state = (State) st;
+
+	// pidfd is local to the daemon
+	pidfd = -1;
 }
@@ -0,0 +1,394 @@
+#include "status_board.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Debug.h"
+
+using namespace std;
+
+status_board::status_board() :
+		fd(-1), base(NULL), size(0), used(0), stale(false)
+{
+}
+
+status_board::~status_board()
+{
+	close();
+}
+
+bool status_board::create(const std::string & path, const size_t capacity)
+{
+	close();
+
+	this->path = path;
+
+	// readers may have the previous board mapped, replace the file instead of truncating it
+	string temp = path + ".tmp";
+
+	fd = ::open(temp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		DD("open(%s) failed: %s\n", temp.c_str(), strerror(errno));
+		return false;
+	}
+
+	size_t new_size = sizeof(header) + capacity * sizeof(slot);
+
+	if (::ftruncate(fd, new_size) < 0
+			|| !map_file(new_size, PROT_READ | PROT_WRITE))
+	{
+		DD("ftruncate(%s) failed: %s\n", temp.c_str(), strerror(errno));
+		::unlink(temp.c_str());
+		close();
+		return false;
+	}
+
+	header * h = (header *) base;
+	h->version = board_version;
+	h->slot_size = sizeof(slot);
+	h->capacity = capacity;
+	h->complete = 0;
+	h->daemon_pid = ::getpid();
+
+	// readers check magic last
+	__sync_synchronize();
+	h->magic = board_magic;
+
+	if (::rename(temp.c_str(), path.c_str()) < 0)
+	{
+		DD("rename(%s) failed: %s\n", path.c_str(), strerror(errno));
+		::unlink(temp.c_str());
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+bool status_board::open(const std::string & path)
+{
+	close();
+
+	this->path = path;
+
+	fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+
+	if (::fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(header)
+			|| !map_file(st.st_size, PROT_READ))
+	{
+		close();
+		return false;
+	}
+
+	const header * h = (const header *) base;
+
+	// unknown layout or stale board of a dead daemon
+	if (h->magic != board_magic || h->version != board_version
+			|| h->slot_size != sizeof(slot)
+			|| (::kill(h->daemon_pid, 0) < 0 && errno == ESRCH))
+	{
+		close();
+		return false;
+	}
+
+	// file descriptor is not needed once mapped
+	::close(fd);
+	fd = -1;
+
+	return true;
+}
+
+void status_board::close()
+{
+	if (base != NULL)
+	{
+		::munmap(base, size);
+		base = NULL;
+		size = 0;
+	}
+
+	if (fd >= 0)
+	{
+		::close(fd);
+		fd = -1;
+	}
+
+	slots.clear();
+	used = 0;
+	stale = false;
+}
+
+bool status_board::update(const status & st)
+{
+	if (fd < 0 || st.name.empty() || st.name.size() > max_name_length)
+		return false;
+
+	size_t index;
+
+	map<string, size_t>::iterator it = slots.find(st.name);
+	if (it != slots.end())
+		index = it->second;
+	else
+	{
+		// keep probe sequences short
+		if ((used + 1) * 4 > slot_count() * 3 && !grow())
+			return false;
+
+		size_t mask = slot_count() - 1;
+
+		// first free slot of the probe sequence, released slots are reused
+		index = hash(st.name) & mask;
+		while (slot_at(index)->name[0] != '\0')
+			index = (index + 1) & mask;
+
+		if (!slot_at(index)->used)
+			++used;
+	}
+
+	slot * s = slot_at(index);
+
+	begin_write(s);
+
+	s->pid = st.pid;
+	s->state = st.state;
+	s->respawn_count = st.respawn_count;
+	s->exit_code = st.exit_code;
+	s->start_time = st.start_time;
+	s->used = 1;
+	::memset(s->name, 0, sizeof(s->name));
+	::memcpy(s->name, st.name.data(), st.name.size());
+
+	end_write(s);
+
+	slots[st.name] = index;
+
+	return true;
+}
+
+void status_board::remove(const std::string & name)
+{
+	map<string, size_t>::iterator it = slots.find(name);
+	if (it == slots.end())
+		return;
+
+	slot * s = slot_at(it->second);
+
+	// slot stays used, probing continues past it
+	begin_write(s);
+	s->name[0] = '\0';
+	end_write(s);
+
+	slots.erase(it);
+}
+
+void status_board::names(std::vector<std::string> & names) const
+{
+	names.clear();
+
+	for (map<string, size_t>::const_iterator it = slots.begin();
+			it != slots.end(); ++it)
+		names.push_back(it->first);
+}
+
+void status_board::set_complete(bool complete)
+{
+	if (fd < 0)
+		return;
+
+	((header *) base)->complete = complete ? 1 : 0;
+}
+
+bool status_board::complete() const
+{
+	if (base == NULL || stale)
+		return false;
+
+	return ((volatile header *) base)->complete != 0;
+}
+
+bool status_board::find(const std::string & name, status & st) const
+{
+	size_t count = slot_count();
+	if (count == 0)
+		return false;
+
+	size_t mask = count - 1;
+	size_t index = hash(name) & mask;
+
+	for (size_t i = 0; i < count; ++i, index = (index + 1) & mask)
+	{
+		const volatile slot * s = slot_at(index);
+
+		// end of probe sequence
+		if (!s->used)
+			return false;
+
+		// unsynchronized compare, the match is verified by the consistent copy
+		if (::strncmp((const char *) s->name, name.c_str(), sizeof(s->name)) != 0)
+			continue;
+
+		if (read_slot(slot_at(index), st) && st.name == name)
+			return true;
+
+		if (stale)
+			return false;
+	}
+
+	return false;
+}
+
+void status_board::read_all(std::vector<status> & statuses) const
+{
+	size_t count = slot_count();
+	status st;
+
+	statuses.clear();
+
+	for (size_t i = 0; i < count && !stale; ++i)
+	{
+		if (read_slot(slot_at(i), st))
+			statuses.push_back(st);
+	}
+
+	if (stale)
+		statuses.clear();
+}
+
+size_t status_board::slot_count() const
+{
+	if (base == NULL)
+		return 0;
+
+	size_t mapped = (size - sizeof(header)) / sizeof(slot);
+	size_t capacity = ((const header *) base)->capacity;
+
+	// capacity is a power of two, a short file is ignored
+	return capacity <= mapped ? capacity : 0;
+}
+
+uint32_t status_board::hash(const std::string & name)
+{
+	uint32_t h = 2166136261U;
+
+	for (size_t i = 0; i < name.size(); ++i)
+	{
+		h ^= (unsigned char) name[i];
+		h *= 16777619U;
+	}
+
+	return h;
+}
+
+bool status_board::read_slot(const slot * s, status & st) const
+{
+	const volatile slot * vs = s;
+	char name[max_name_length + 1];
+
+	if (stale)
+		return false;
+
+	for (unsigned int tries = 1; true; ++tries)
+	{
+		// a daemon killed in the middle of a write leaves the slot odd
+		if (tries > read_retries
+				|| (tries % read_check_interval == 0 && !writer_alive()))
+		{
+			stale = true;
+			return false;
+		}
+
+		uint32_t seq = vs->seq;
+		if (seq & 1)
+			continue;
+
+		__sync_synchronize();
+
+		st.pid = vs->pid;
+		st.state = vs->state;
+		st.respawn_count = vs->respawn_count;
+		st.exit_code = vs->exit_code;
+		st.start_time = vs->start_time;
+		::memcpy(name, (const void *) vs->name, sizeof(name));
+
+		__sync_synchronize();
+
+		if (vs->seq == seq)
+			break;
+	}
+
+	name[max_name_length] = '\0';
+	st.name = name;
+
+	return !st.name.empty();
+}
+
+bool status_board::writer_alive() const
+{
+	pid_t pid = ((const volatile header *) base)->daemon_pid;
+
+	return ::kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+void status_board::begin_write(slot * s)
+{
+	((volatile slot *) s)->seq = s->seq + 1;
+	__sync_synchronize();
+}
+
+void status_board::end_write(slot * s)
+{
+	__sync_synchronize();
+	((volatile slot *) s)->seq = s->seq + 1;
+}
+
+bool status_board::map_file(size_t new_size, int prot)
+{
+	void * p = ::mmap(NULL, new_size, prot, MAP_SHARED, fd, 0);
+	if (p == MAP_FAILED)
+	{
+		DD("mmap(%s) failed: %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+
+	if (base != NULL)
+		::munmap(base, size);
+
+	base = p;
+	size = new_size;
+
+	return true;
+}
+
+bool status_board::grow()
+{
+	vector<status> statuses;
+	bool was_complete = complete();
+	size_t capacity = slot_count() * 2;
+
+	read_all(statuses);
+
+	// slots move, readers of the current board keep their copy
+	if (!create(path, capacity))
+	{
+		::unlink(path.c_str());
+		return false;
+	}
+
+	for (size_t i = 0; i < statuses.size(); ++i)
+		update(statuses[i]);
+
+	set_complete(was_complete);
+
+	return true;
+}
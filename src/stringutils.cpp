@@ -58,3 +58,18 @@ void stringutils::splitLine(const std::string& str,
 {
 	split(str, "\n", parts);
 }
+
+std::string stringutils::join(const std::vector<std::string>& parts,
+		const std::string& delim)
+{
+	std::string str;
+
+	for (size_t i = 0; i < parts.size(); ++i)
+	{
+		if (i > 0)
+			str += delim;
+		str += parts[i];
+	}
+
+	return str;
+}
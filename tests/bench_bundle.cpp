@@ -0,0 +1,117 @@
+/*
+ * Bundle encode throughput for 1 KB and 1 MB bundles
+ *
+ * Builds bundles of records (an int and a 40 byte string) up to the target
+ * size, then exports, copies and moves them, and decodes them again after
+ * importData(). Every step is repeated until about 256 MB went through it
+ * and is reported in MB/s of bundle data.
+ *
+ * build:	g++ -O2 -Iinc tests/bench_bundle.cpp $(find src -name '*.cpp' ! -name main.cpp) \
+ *				-o bench_bundle -lpthread
+ * run:		./bench_bundle
+ */
+
+#include <cstdio>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <time.h>
+
+#include <serializer/Bundle.h>
+
+using namespace std;
+
+/** @brief Monotonic clock in seconds */
+static double now_s()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** @brief Append records of an int and value to bundle */
+static void build(Bundle & bundle, const int records, const string & value)
+{
+	for (int i = 0; i < records; ++i)
+		bundle << i << value;
+}
+
+/** @brief Print throughput of rounds bundles of bytes each in seconds */
+static void report(const char * step, const int rounds, const int bytes,
+		const double seconds)
+{
+	::printf("  %-8s %8.0f MB/s\n", step, (double) rounds * bytes / seconds / 1e6);
+}
+
+static void bench(const int size)
+{
+	const string value(40, 'x');
+
+	// records of the target size
+	Bundle probe;
+	build(probe, 1, value);
+	int records = size / probe.byteCount();
+	if (records < 1)
+		records = 1;
+
+	Bundle bundle;
+	build(bundle, records, value);
+
+	const int bytes = bundle.byteCount();
+	const int rounds = 256 * 1024 * 1024 / bytes;
+
+	::printf("%d records, %d bytes, %d rounds\n", records, bytes, rounds);
+
+	double t0 = now_s();
+	for (int r = 0; r < rounds; ++r)
+	{
+		Bundle b;
+		build(b, records, value);
+	}
+	report("build", rounds, bytes, now_s() - t0);
+
+	vector<unsigned char> data(bytes + 16);
+	int length = 0;
+
+	t0 = now_s();
+	for (int r = 0; r < rounds; ++r)
+		length = bundle.exportData(&data[0], data.size());
+	report("export", rounds, bytes, now_s() - t0);
+
+	t0 = now_s();
+	for (int r = 0; r < rounds; ++r)
+	{
+		Bundle copy(bundle);
+		Bundle moved(std::move(copy));
+	}
+	report("copy", rounds, bytes, now_s() - t0);
+
+	// keeps the decode loop
+	volatile int sum = 0;
+
+	t0 = now_s();
+	for (int r = 0; r < rounds; ++r)
+	{
+		Bundle b;
+		b.importData(&data[0], length);
+
+		int i;
+		string s;
+		while (b.count() > 0)
+		{
+			b >> i >> s;
+			sum = sum + i;
+		}
+	}
+	report("decode", rounds, bytes, now_s() - t0);
+}
+
+int main()
+{
+	bench(1024);
+	bench(1024 * 1024);
+
+	return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * Commands per second of a running daemon under a burst of clients
+ *
+ * Forks <clients> processes, each with its own connection. They are released
+ * together and pipeline <commands> STATUS requests each, keeping up to
+ * <window> requests in flight, so the daemon receives bursts from many
+ * connections at once. Reports the commands answered per second.
+ *
+ * build:	g++ -O2 -Iinc tests/bench_burst.cpp $(find src -name '*.cpp' ! -name main.cpp) \
+ *				-o bench_burst -lpthread
+ * run:		./service -d &
+ *			./bench_burst [<clients> [<commands> [<window>]]]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <ipc/ipc.h>
+
+#include "ServiceMessages.h"
+
+using namespace std;
+
+/** @brief Monotonic clock in seconds */
+static double now_s()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/** @brief Count a reply, context is the reply counter */
+static bool on_reply(uint32_t request_id, Bundle & reply, void * context)
+{
+	++*(int *) context;
+
+	return false;
+}
+
+/**
+ * @brief Client process: connect, report ready, wait for the gate, send commands
+ * @return			exit code, 0 if every command is answered
+ */
+static int run_client(int ready_fd, int gate_fd, int commands, int window)
+{
+	AsyncClient client(IPC_PATH_SERVICE);
+
+	char c = 0;
+	if (::write(ready_fd, &c, 1) != 1)
+		return 1;
+
+	// returns at EOF, when the parent closes the gate
+	while (::read(gate_fd, &c, 1) > 0)
+		;
+
+	Bundle request;
+	request << SERVICE_CMD_STATUS << "bench";
+
+	int sent = 0;
+	int answered = 0;
+
+	while (answered < commands)
+	{
+		for (; sent < commands && sent - answered < window; ++sent)
+		{
+			if (client.submit(request, on_reply, &answered) == 0)
+				return 1;
+		}
+
+		if (client.dispatch(1000) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+int main(int argc, char * argv[])
+{
+	int clients = (argc > 1) ? ::atoi(argv[1]) : 32;
+	int commands = (argc > 2) ? ::atoi(argv[2]) : 10000;
+	int window = (argc > 3) ? ::atoi(argv[3]) : 256;
+
+	int ready[2];
+	int gate[2];
+	if (::pipe(ready) < 0 || ::pipe(gate) < 0)
+	{
+		::perror("pipe");
+		return 1;
+	}
+
+	vector<pid_t> children;
+
+	for (int i = 0; i < clients; ++i)
+	{
+		pid_t pid = ::fork();
+		if (pid == 0)
+		{
+			::close(ready[0]);
+			::close(gate[1]);
+			::_exit(run_client(ready[1], gate[0], commands, window));
+		}
+
+		children.push_back(pid);
+	}
+
+	::close(ready[1]);
+	::close(gate[0]);
+
+	// every client is connected
+	char c;
+	for (int i = 0; i < clients; ++i)
+	{
+		if (::read(ready[0], &c, 1) != 1)
+		{
+			::fprintf(stderr, "client failed to start\n");
+			return 1;
+		}
+	}
+
+	double start = now_s();
+	::close(gate[1]);
+
+	int failed = 0;
+	for (size_t i = 0; i < children.size(); ++i)
+	{
+		int status;
+		::waitpid(children[i], &status, 0);
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			++failed;
+	}
+	double elapsed = now_s() - start;
+
+	if (failed > 0)
+	{
+		::fprintf(stderr, "%d of %d clients failed\n", failed, clients);
+		return 1;
+	}
+
+	::printf("%d clients x %d commands, window %d: %.0f commands/s\n",
+			clients, commands, window, (double) clients * commands / elapsed);
+
+	return 0;
+}
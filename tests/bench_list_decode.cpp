@@ -0,0 +1,108 @@
+/*
+ * Decode time of a 10,000-service LIST response
+ *
+ * Builds a LIST response ([true, more, next page cursor, fields, record...])
+ * of <services> services in one bundle, once with full records and once with
+ * name, state and pid fields, and decodes it after importData() with the loop
+ * of service_client: while (response.count() > 0) read a record.
+ *
+ * build:	g++ -O2 -Iinc tests/bench_list_decode.cpp $(find src -name '*.cpp' ! -name main.cpp) \
+ *				-o bench_list_decode -lpthread
+ * run:		./bench_list_decode [<services>]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <time.h>
+
+#include <serializer/Bundle.h>
+
+#include "service_t.h"
+#include "stringutils.h"
+
+using namespace std;
+
+/** @brief Monotonic clock in milliseconds */
+static double now_ms()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * @brief Build, export, import and decode a LIST response
+ * @param fields	record fields, 0 for full records
+ * @return			false if a record is lost
+ */
+static bool bench(const int services, const int fields)
+{
+	Bundle response;
+	response << true << false << "" << fields;
+
+	for (int i = 0; i < services; ++i)
+	{
+		service_t s;
+		s.cfg.name = "service" + stringutils::to_string(i);
+		s.cfg.exec = "exec sleep 1000";
+		s.cfg.pidfile = "/run/service/" + s.cfg.name + ".pid";
+		s.pid = 1000 + i;
+		s.state = service_t::ST_RUNNING;
+
+		if (fields == 0)
+			response << s;
+		else
+			s.write_fields(response, fields);
+	}
+
+	vector<unsigned char> data(response.byteCount() + 16);
+	int length = response.exportData(&data[0], data.size());
+
+	double t0 = now_ms();
+
+	Bundle received;
+	received.importData(&data[0], length);
+
+	double t1 = now_ms();
+
+	received.getBool();
+	received.getBool();
+	received.getString();
+	int record_fields = received.getInt();
+
+	int decoded = 0;
+	while (received.count() > 0)
+	{
+		service_t s;
+
+		if (record_fields == 0)
+			received >> s;
+		else
+			s.read_fields(received, record_fields);
+
+		++decoded;
+	}
+
+	double t2 = now_ms();
+
+	::printf("%-16s %d services, %d bytes: import %.2f ms, decode %.2f ms\n",
+			fields == 0 ? "full:" : "name,state,pid:", decoded, length, t1 - t0,
+			t2 - t1);
+
+	return decoded == services;
+}
+
+int main(int argc, char * argv[])
+{
+	int services = (argc > 1) ? ::atoi(argv[1]) : 10000;
+
+	bool ok = bench(services, 0);
+	ok = bench(services, service_t::F_NAME | service_t::F_STATE
+			| service_t::F_PID) && ok;
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,116 @@
+/*
+ * Idle wakeups and command round trip of a running daemon
+ *
+ * Counts the context switches of the idle daemon (/proc/<pid>/status) for a
+ * few seconds, then sends STATUS queries one at a time and reports their
+ * round trip latency.
+ *
+ * build:	g++ -O2 -Iinc tests/bench_reactor.cpp $(find src -name '*.cpp' ! -name main.cpp) \
+ *				-o bench_reactor -lpthread
+ * run:		./service -d &
+ *			./bench_reactor $(pgrep -x service) [<idle seconds> [<queries>]]
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include <ipc/ipc.h>
+
+#include "ServiceMessages.h"
+
+using namespace std;
+
+/** @brief Monotonic clock in microseconds */
+static double now_us()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/** @brief Voluntary plus involuntary context switches of a process, -1 if unknown */
+static long long context_switches(pid_t pid)
+{
+	char path[64];
+	::snprintf(path, sizeof(path), "/proc/%d/status", (int) pid);
+
+	ifstream ifs(path);
+	string line;
+	long long total = -1;
+
+	while (getline(ifs, line))
+	{
+		if (line.find("ctxt_switches:") == string::npos)
+			continue;
+
+		total = (total < 0 ? 0 : total)
+				+ ::atoll(line.c_str() + line.find(':') + 1);
+	}
+
+	return total;
+}
+
+int main(int argc, char * argv[])
+{
+	if (argc < 2)
+	{
+		::fprintf(stderr, "usage: %s <daemon pid> [<idle seconds> [<queries>]]\n",
+				argv[0]);
+		return 1;
+	}
+
+	pid_t pid = ::atoi(argv[1]);
+	int seconds = (argc > 2) ? ::atoi(argv[2]) : 5;
+	int queries = (argc > 3) ? ::atoi(argv[3]) : 10000;
+
+	long long before = context_switches(pid);
+	::sleep(seconds);
+	long long after = context_switches(pid);
+
+	if (before < 0 || after < 0)
+	{
+		::fprintf(stderr, "no such process: %d\n", (int) pid);
+		return 1;
+	}
+
+	::printf("idle wakeups/s:   %.1f\n", (double) (after - before) / seconds);
+
+	DomainClient client;
+	vector<double> latencies;
+	latencies.reserve(queries);
+
+	for (int i = 0; i < queries; ++i)
+	{
+		Bundle request, response;
+		request << SERVICE_CMD_STATUS << "bench";
+
+		double start = now_us();
+		if (!client.query(IPC_PATH_SERVICE, request, response, 1000))
+		{
+			::fprintf(stderr, "query failed\n");
+			return 1;
+		}
+		latencies.push_back(now_us() - start);
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+
+	double sum = 0;
+	for (size_t i = 0; i < latencies.size(); ++i)
+		sum += latencies[i];
+
+	::printf("round trip (us):  mean %.1f  p50 %.1f  p99 %.1f  (%d queries)\n",
+			sum / queries, latencies[queries / 2], latencies[queries * 99 / 100],
+			queries);
+
+	return 0;
+}
@@ -0,0 +1,162 @@
+/*
+ * Service starts per second, posix_spawn against the former double fork
+ *
+ * Starts "exec true" services one after another and reaps each one before the
+ * next start. The spawn path is service_t::start(); the former path (fork,
+ * setsid, fork, fstat() of every fd up to RLIMIT_NOFILE, exec) is reproduced
+ * here for comparison. The soft nofile limit is raised to <nofile> (default:
+ * the hard limit), which is what makes the fd sweep expensive.
+ *
+ * build:	g++ -O2 -Iinc tests/bench_spawn.cpp $(find src -name '*.cpp' ! -name main.cpp) \
+ *				-o bench_spawn -lpthread
+ * run:		./bench_spawn [<starts> [<nofile>]]
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config_t.h"
+#include "script_cache.h"
+#include "service_t.h"
+
+using namespace std;
+
+/** @brief Monotonic clock in seconds */
+static double now_s()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * @brief Former start path: double fork, setsid and fd sweep in the child
+ * @return			pid of the service process, -1 on error
+ */
+static pid_t legacy_start(const char * exec)
+{
+	int ready[2];
+	if (::pipe2(ready, O_CLOEXEC) < 0)
+		return -1;
+
+	pid_t child = ::fork();
+	if (child < 0)
+	{
+		::close(ready[0]);
+		::close(ready[1]);
+		return -1;
+	}
+
+	if (child > 0)
+	{
+		::close(ready[1]);
+		::waitpid(child, NULL, 0);
+
+		pid_t self = -1;
+		if (::read(ready[0], &self, sizeof(self)) != sizeof(self))
+			self = -1;
+		::close(ready[0]);
+
+		return self;
+	}
+
+	::close(ready[0]);
+	::setsid();
+
+	if (::fork() != 0)
+		::_exit(0);
+
+	pid_t self = ::getpid();
+	if (::write(ready[1], &self, sizeof(self)) != sizeof(self))
+		::_exit(1);
+
+	if (::chdir("/") == -1)
+		::_exit(1);
+
+	struct rlimit rlim;
+	::getrlimit(RLIMIT_NOFILE, &rlim);
+
+	for (int i = 3; i < (int) rlim.rlim_cur; ++i)
+	{
+		struct stat statbuf;
+
+		if (i != ready[1] && ::fstat(i, &statbuf) == 0)
+			::close(i);
+	}
+
+	int in = ::open(config_t::null_device.c_str(), O_RDONLY);
+	int out = ::open(config_t::null_device.c_str(), O_WRONLY);
+	::dup2(in, STDIN_FILENO);
+	::dup2(out, STDOUT_FILENO);
+	::dup2(out, STDERR_FILENO);
+
+	::execl(service_t::default_shell.c_str(), service_t::default_shell.c_str(),
+			"-c", exec, (char *) NULL);
+	::_exit(127);
+}
+
+int main(int argc, char * argv[])
+{
+	int starts = (argc > 1) ? ::atoi(argv[1]) : 1000;
+
+	struct rlimit rlim;
+	::getrlimit(RLIMIT_NOFILE, &rlim);
+	rlim.rlim_cur = (argc > 2) ? (rlim_t) ::atol(argv[2]) : rlim.rlim_max;
+	if (::setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		::perror("setrlimit");
+	::getrlimit(RLIMIT_NOFILE, &rlim);
+
+	// former service processes are grandchildren, reap them here
+	::prctl(PR_SET_CHILD_SUBREAPER, 1);
+
+	service_t s;
+	s.cfg.name = "bench_spawn";
+	s.cfg.exec = "exec true";
+
+	script_cache scripts;
+
+	double t0 = now_s();
+	for (int i = 0; i < starts; ++i)
+	{
+		if (!s.start(scripts))
+		{
+			::fprintf(stderr, "start failed\n");
+			return 1;
+		}
+
+		::waitpid(s.pid, NULL, 0);
+		s.on_exit();
+	}
+	double t1 = now_s();
+
+	for (int i = 0; i < starts; ++i)
+	{
+		pid_t pid = legacy_start(s.cfg.exec.c_str());
+		if (pid < 0)
+		{
+			::fprintf(stderr, "legacy start failed\n");
+			return 1;
+		}
+
+		while (::waitpid(pid, NULL, 0) < 0 && errno == EINTR)
+			;
+	}
+	double t2 = now_s();
+
+	::printf("nofile:       %llu\n", (unsigned long long) rlim.rlim_cur);
+	::printf("posix_spawn:  %.0f starts/s\n", starts / (t1 - t0));
+	::printf("double fork:  %.0f starts/s\n", starts / (t2 - t1));
+
+	return 0;
+}
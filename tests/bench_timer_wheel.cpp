@@ -0,0 +1,98 @@
+/*
+ * TimerWheel microbenchmark with 100k timers
+ *
+ * Adds timers with random delays (10% beyond the first four levels),
+ * cancels half of them, then drives the wheel on a simulated clock from
+ * next_tick() to next_tick() and checks that every remaining timer fires
+ * on its exact tick.
+ *
+ * build:	g++ -O2 -Iinc tests/bench_timer_wheel.cpp src/TimerWheel.cpp src/Timer.cpp \
+ *				-o bench_timer_wheel
+ * run:		./bench_timer_wheel [<timers>]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+#include <time.h>
+
+#include "TimerWheel.h"
+
+using namespace std;
+
+/** @brief Monotonic clock in nanoseconds */
+static double now_ns()
+{
+	struct timespec ts;
+	::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char * argv[])
+{
+	int count = (argc > 1) ? ::atoi(argv[1]) : 100000;
+
+	TimerWheel wheel;
+	vector<TimerWheel::Expired> expired;
+
+	// simulated clock ahead of the real one, add() counts from it
+	uint64_t start = wheel.current_tick() + 1000;
+	wheel.advance(start, expired);
+
+	const uint64_t near = 1ULL << (4 * TimerWheel::SLOT_BITS);
+	const uint64_t far = 1ULL << (TimerWheel::LEVELS * TimerWheel::SLOT_BITS);
+
+	::srand(1);
+
+	vector<uint64_t> delays(count);
+	for (int i = 0; i < count; ++i)
+	{
+		uint64_t r = ((uint64_t) ::rand() << 16) ^ ::rand();
+		delays[i] = (i % 10 == 0) ? near + r % (far - near) : 1 + r % near;
+	}
+
+	vector<TimerWheel::timer_id> ids(count);
+
+	double t0 = now_ns();
+	for (int i = 0; i < count; ++i)
+		ids[i] = wheel.add(delays[i], 0, "");
+	double t1 = now_ns();
+
+	for (int i = 0; i < count; i += 2)
+		wheel.cancel(ids[i]);
+	double t2 = now_ns();
+
+	// expected tick of the remaining timers
+	map<TimerWheel::timer_id, uint64_t> due;
+	for (int i = 1; i < count; i += 2)
+		due[ids[i]] = start + delays[i];
+
+	size_t fired = 0;
+	size_t late = 0;
+	uint64_t tick;
+
+	double t3 = now_ns();
+	while (wheel.next_tick(tick))
+	{
+		expired.clear();
+		wheel.advance(tick, expired);
+
+		for (size_t i = 0; i < expired.size(); ++i, ++fired)
+		{
+			if (due[expired[i].id] != tick)
+				++late;
+		}
+	}
+	double t4 = now_ns();
+
+	::printf("add:     %.0f ns/timer\n", (t1 - t0) / count);
+	::printf("cancel:  %.0f ns/timer\n", (t2 - t1) / ((count + 1) / 2));
+	::printf("expire:  %.0f ns/timer\n", (t4 - t3) / (fired ? fired : 1));
+	::printf("fired:   %zu of %zu, %zu not on their tick\n", fired, due.size(),
+			late);
+
+	return (fired == due.size() && late == 0) ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#!/bin/bash
+#
+# STATUS latency while slow lifecycle operations are in progress
+#
+# Starts a daemon with 50 services whose onstop takes ONSTOP_SECONDS, then
+# restarts all of them at once: each start waits for its onstop, so 50 starts
+# are pending at the same time. STATUS is queried from the daemon meanwhile
+# and every round trip must stay under MAX_MS. The restart must still succeed.
+#
+# usage: tests/status_latency.sh [<service binary>]
+#
+# Runs a daemon of its own (no other daemon may be running) and needs write
+# access to /run/service.
+
+SERVICE=$(readlink -f "${1:-./service}")
+COUNT=50
+ONSTOP_SECONDS=3
+MAX_MS=${MAX_MS:-100}
+STATUS_FILE=/run/service/services.status
+
+if [ ! -x "$SERVICE" ]; then
+	echo "FAIL: service binary not found: $SERVICE"
+	exit 1
+fi
+
+WORKDIR=$(mktemp -d)
+mkdir -p "$WORKDIR/services"
+
+for i in $(seq 1 $COUNT); do
+	cat > "$WORKDIR/services/slow$i.conf" <<EOF
+exec sleep 1000
+onstop exec sleep $ONSTOP_SECONDS
+EOF
+done
+
+cd "$WORKDIR" || exit 1
+
+cleanup()
+{
+	"$SERVICE" stop -j $COUNT 'slow*' > /dev/null 2>&1
+	kill $DAEMON_PID 2> /dev/null
+	wait $DAEMON_PID 2> /dev/null
+	cd / && rm -rf "$WORKDIR"
+}
+
+"$SERVICE" -d > daemon.log 2>&1 &
+DAEMON_PID=$!
+trap cleanup EXIT
+
+sleep 1
+
+if ! "$SERVICE" start -j $COUNT 'slow*' > /dev/null; then
+	echo "FAIL: could not start services"
+	exit 1
+fi
+
+# without the status board, status queries the daemon
+rm -f "$STATUS_FILE"
+
+# STATUS round trip in milliseconds
+status_ms()
+{
+	local t0 t1
+	t0=$(date +%s%N)
+	"$SERVICE" status slow1 > /dev/null || return 1
+	t1=$(date +%s%N)
+	echo $(( (t1 - t0) / 1000000 ))
+}
+
+idle_max=0
+for i in $(seq 1 20); do
+	ms=$(status_ms) || { echo "FAIL: status failed while idle"; exit 1; }
+	[ $ms -gt $idle_max ] && idle_max=$ms
+done
+
+"$SERVICE" restart -j $COUNT 'slow*' > restart.log 2>&1 &
+RESTART_PID=$!
+
+# sample while the starts wait for their onstop, not while they spawn
+now_ms()
+{
+	echo $(( $(date +%s%N) / 1000000 ))
+}
+
+deadline=$(( $(now_ms) + ONSTOP_SECONDS * 1000 - 300 ))
+
+# let every restart reach its pending start
+sleep 0.3
+
+busy_max=0
+samples=0
+while [ $(now_ms) -lt $deadline ]; do
+	if ! kill -0 $RESTART_PID 2> /dev/null; then
+		echo "FAIL: restart finished too early, starts were not slow"
+		exit 1
+	fi
+
+	ms=$(status_ms) || { echo "FAIL: status failed during restart"; exit 1; }
+	[ $ms -gt $busy_max ] && busy_max=$ms
+	samples=$((samples + 1))
+	sleep 0.05
+done
+
+wait $RESTART_PID
+restart_rc=$?
+
+echo "idle max ${idle_max} ms, during $COUNT slow starts max ${busy_max} ms" \
+		"($samples samples)"
+
+if [ $restart_rc -ne 0 ]; then
+	echo "FAIL: restart failed"
+	cat restart.log
+	exit 1
+fi
+
+if [ $busy_max -gt $MAX_MS ]; then
+	echo "FAIL: status took ${busy_max} ms (max ${MAX_MS} ms)"
+	exit 1
+fi
+
+echo "PASS"